@@ -7,6 +7,10 @@
  * Old time stamp could removed, since time stamp counter no longer tracks clock cycles
  * (C) R. E. Bryant, 2016
  *
+ * Counter reads the time stamp counter again when it is invariant.
+ * Its rate is calibrated against CLOCK_MONOTONIC, so counts are in
+ * reference cycles at a fixed frequency, and comparable across runs.
+ *
  */
 
 /* If defined, will use clock_gettime, rather than gettimeofday */
@@ -19,6 +23,9 @@
 #else
 #include <time.h>
 #endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 #include "clock.h"
 
 int gverbose = 1;
@@ -49,7 +56,6 @@ double core_mhz(int verbose) {
     }
     while (fgets(buf, MAXBUF, fp)) {
 	if (strstr(buf, "cpu MHz")) {
-	    double cpu_mhz = 0.0;
 	    sscanf(buf, "cpu MHz\t: %lf", &cpu_mhz);
 	    break;
 	}
@@ -66,9 +72,71 @@ double core_mhz(int verbose) {
     return cpu_mhz;
 }
 
+/* Does CPUID report an invariant TSC (leaf 0x80000007, EDX bit 8)? */
+int tsc_invariant(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+	return 0;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+	return 0;
+    return (edx >> 8) & 1;
+#else
+    return 0;
+#endif
+}
+
+/* Calibrate by spinning for CALIBRATE_NSECS, several times over,
+   and taking the median estimate */
+#define CALIBRATE_NSECS  10000000
+#define CALIBRATE_TRIALS 5
+
+static double mono_nsecs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+double tsc_mhz(int verbose) {
+    static double tsc_rate = 0.0;
+    double est[CALIBRATE_TRIALS];
+    int i, j;
+    if (tsc_rate != 0.0)
+	return tsc_rate;
+    for (i = 0; i < CALIBRATE_TRIALS; i++) {
+	double n0 = mono_nsecs();
+	uint64_t c0 = read_tscp();
+	double n1;
+	uint64_t c1;
+	do {
+	    n1 = mono_nsecs();
+	    c1 = read_tscp();
+	} while (n1 - n0 < CALIBRATE_NSECS);
+	/* Cycles per nanosecond, scaled to MHz */
+	est[i] = 1e3 * (double) (c1 - c0) / (n1 - n0);
+	/* Insertion sort */
+	for (j = i; j > 0 && est[j-1] > est[j]; j--) {
+	    double temp = est[j-1];
+	    est[j-1] = est[j];
+	    est[j] = temp;
+	}
+    }
+    tsc_rate = est[CALIBRATE_TRIALS/2];
+    if (verbose) {
+	printf("Time stamp counter rate ~= %.4f GHz (calibrated against CLOCK_MONOTONIC)\n",
+	       tsc_rate * 0.001);
+    }
+    return tsc_rate;
+}
+
+/* Whether the counter reads the time stamp counter.  -1 until decided */
+static int use_tsc = -1;
+
 double mhz(int verbose) {
-    double val = core_mhz(verbose);
-    return val;
+    if (use_tsc < 0)
+	use_tsc = tsc_invariant();
+    cpu_mhz = use_tsc ? tsc_mhz(verbose) : core_mhz(verbose);
+    return cpu_mhz;
 }
 
 #ifdef USE_TOD
@@ -128,16 +196,72 @@ double get_timer()
     return delta_secs;
 }
 
+double read_timer()
+{
+    int rval;
+#ifdef USE_TOD
+    struct timeval now;
+    rval = gettimeofday(&now, NULL);
+#else
+    struct timespec now;
+    rval = clock_gettime(CLKT, &now);
+#endif
+    if (rval != 0) {
+	fprintf(stderr, "Couldn't get time\n");
+	exit(1);
+    }
+#ifdef USE_TOD
+    return 1.0 * now.tv_sec + 1e-6 * now.tv_usec;
+#else
+    return 1.0 * now.tv_sec + 1e-9 * now.tv_nsec;
+#endif
+}
+
+double read_counter()
+{
+    if (cpu_mhz == 0.0)
+	mhz(gverbose);
+    if (use_tsc)
+	return (double) read_tscp();
+    return read_timer() * cpu_mhz * 1e6;
+}
+
+static uint64_t last_tsc;
+
 void start_counter()
 {
     if (cpu_mhz == 0.0)
 	mhz(gverbose);
-    start_timer();
+    if (use_tsc)
+	last_tsc = read_tsc();
+    else
+	start_timer();
 }
 
 double get_counter()
 {
+    if (use_tsc)
+	return (double) (read_tscp() - last_tsc);
     double delta_secs = get_timer();
     return delta_secs * cpu_mhz * 1e6;
 }
 
+
+/* Cost of reading the time stamp counter.  Take the minimum over
+   many trials, since any one pair may be hit by an interrupt */
+#define OVERHEAD_TRIALS 1000
+
+uint64_t tsc_overhead(void)
+{
+    static uint64_t overhead = UINT64_MAX;
+    int i;
+    if (overhead != UINT64_MAX)
+	return overhead;
+    for (i = 0; i < OVERHEAD_TRIALS; i++) {
+	uint64_t t0 = read_tsc();
+	uint64_t t1 = read_tsc();
+	if (t1 - t0 < overhead)
+	    overhead = t1 - t0;
+    }
+    return overhead;
+}
@@ -1,4 +1,6 @@
 /* Routines for timing functions */
+#include <stdint.h>
+#include <time.h>
 
 /*  minimum resolution of timer (secs) */
 extern const double timer_resolution;
@@ -11,12 +13,69 @@ void start_timer();
 /* Get # seconds since timer started.  Returns 1e20 if detect timing anomaly */
 double get_timer();
 
-/* Determine clock rate of processor (using a default sleeptime) */
+/* Determine clock rate of processor.  With an invariant time stamp
+   counter, this is the calibrated rate of the counter */
 double mhz(int verbose);
 
-/* Counter: measures in clock cycles */
+/* Counter: measures in clock cycles.  Reads the time stamp counter
+   directly when it is invariant, and otherwise converts the timer's
+   seconds using the clock rate from /proc/cpuinfo */
 /* Start the counter */
 void start_counter();
 
 /* Get # cycles since counter started.  Returns 1e20 if detect timing anomaly */
 double get_counter();
+
+/* Reentrant timer and counter: each returns the current reading, and
+   the caller keeps its own starting value.  Safe to use from several
+   threads at once, since the timer's clock is per-thread */
+
+/* Current reading of the timer, in seconds */
+double read_timer();
+
+/* Current reading of the counter, in cycles */
+double read_counter();
+
+/* Time stamp counter: cheap enough to bracket a single function call */
+
+/* Read the time stamp counter.  Loads issued before the read must
+   complete first, so the call being timed can't leak past it.  On
+   processors without one, falls back to a nanosecond clock */
+static inline uint64_t read_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("lfence\n\trdtsc" : "=a" (lo), "=d" (hi) :: "memory");
+    return ((uint64_t) hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/* Like read_tsc, but waits for all earlier instructions to finish, and
+   keeps later ones from starting before the counter is read.  Use it
+   at the end of a timed region */
+static inline uint64_t read_tscp(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi, aux;
+    __asm__ __volatile__("rdtscp\n\tlfence" : "=a" (lo), "=d" (hi), "=c" (aux) :: "memory");
+    return ((uint64_t) hi << 32) | lo;
+#else
+    return read_tsc();
+#endif
+}
+
+/* Smallest difference seen between two back-to-back calls to read_tsc */
+uint64_t tsc_overhead(void);
+
+/* Does the processor advertise an invariant time stamp counter, i.e.,
+   one that ticks at a constant rate regardless of frequency scaling
+   and sleep states? */
+int tsc_invariant(void);
+
+/* Rate of the time stamp counter in MHz, calibrated against
+   CLOCK_MONOTONIC the first time it is called */
+double tsc_mhz(int verbose);
@@ -46,10 +46,15 @@
   "syn-struct.rep"
 
 /*
- * Programs for measuring reference throughputs
+ * Adversarial fragmentation traces, made by "tracegen -p <pattern>
+ * -w 2" and counted for utilization only.  The driver adds them to the
+ * default traces when run with -F.
  */
-#define REF_DRIVER "./mdriver-ref"
-
+#define FRAG_TRACEFILES \
+  "frag-pin.rep", \
+  "frag-sawtooth.rep", \
+  "frag-chunk.rep", \
+  "frag-pingpong.rep"
 
 /*
  * Speeds measured relative to a benchmark.  Express thresholds
@@ -111,18 +116,21 @@
 #define CPU_FILE "/proc/cpuinfo"
 
 /*
- * Key in file (spaces removed)
+ * Keys in file (spaces removed)
  */
 #define CPU_KEY "modelname"
+#define MICROCODE_KEY "microcode"
 
 /*
- * File containing throughputs
+ * File caching the throughput of the reference allocator (refmm.c)
+ * for each CPU model and microcode revision
  */
 #define THROUGHPUT_FILE "./throughputs.txt"
 
 /*
- * Keys for checkpoint vs. regular
+ * Name of the benchmark.  Change this whenever refmm.c or the default
+ * traces change, so that cached throughputs are measured again
  */
-#define BENCH_KEY  "regular"
+#define BENCH_KEY  "refmm1"
 
 #endif /* __CONFIG_H */
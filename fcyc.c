@@ -1,5 +1,7 @@
 /* Compute time used by function f */
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/times.h>
 #include <stdio.h>
 
@@ -8,71 +10,129 @@
 
 #define K 3
 #define MAXSAMPLES 20
-#define EPSILON 0.01 
+#define EPSILON 0.01
 #define CLEAR_CACHE 0
 #define CACHE_BYTES (1<<19)
 #define CACHE_BLOCK 32
 #define MIN_TICKS 1000
 #define MIN_REPS 8
+#define CI_WIDTH 0.01
+#define CI_LEVEL 0.95
+#define MIN_ROBUST_SAMPLES 5     /* Samples before first checking the interval */
+#define BOOTSTRAP_RESAMPLES 1000
 
-static long int kbest = K;
-static int clear_cache = CLEAR_CACHE;
-static long int maxsamples = MAXSAMPLES;
-static double epsilon = EPSILON;
-static long int cache_bytes = CACHE_BYTES;
-static long int cache_block = CACHE_BLOCK;
-static long int min_reps = MIN_REPS;
-static long int min_ticks = MIN_TICKS;
-static double min_time = 0;
+#define KEEP_VALS 0
+#define KEEP_SAMPLES 0
+
+/* All state of one measurement context */
+struct fcyc_ctx {
+    /* Parameters */
+    long int kbest;
+    int clear_cache;
+    long int maxsamples;
+    double epsilon;
+    long int cache_bytes;
+    long int cache_block;
+    long int min_reps;
+    long int min_ticks;
+    double min_time;
+    double ci_width;
+    double ci_level;
+
+    /* Buffer read to clear the cache */
+    long int *cache_buf;
+
+    /* K-best samples */
+    double *values;
+    long int samplecount;
+#if KEEP_SAMPLES
+    double *samples;
+#endif
 
-static long int *cache_buf = NULL;
+    /* Generator for bootstrap resampling */
+    uint64_t rng_state;
+};
+
+#define DEFAULT_CTX { \
+    .kbest = K, \
+    .clear_cache = CLEAR_CACHE, \
+    .maxsamples = MAXSAMPLES, \
+    .epsilon = EPSILON, \
+    .cache_bytes = CACHE_BYTES, \
+    .cache_block = CACHE_BLOCK, \
+    .min_reps = MIN_REPS, \
+    .min_ticks = MIN_TICKS, \
+    .min_time = 0, \
+    .ci_width = CI_WIDTH, \
+    .ci_level = CI_LEVEL, \
+}
 
-static double *values = NULL;
-static long int samplecount = 0;
+/* Context used by the non-reentrant routines */
+static fcyc_ctx_t default_ctx = DEFAULT_CTX;
 
-#define KEEP_VALS 0
-#define KEEP_SAMPLES 0
+fcyc_ctx_t *fcyc_ctx_new(void)
+{
+    static const fcyc_ctx_t defaults = DEFAULT_CTX;
+    fcyc_ctx_t *ctx = malloc(sizeof(fcyc_ctx_t));
+    if (!ctx) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in fcyc_ctx_new\n");
+	exit(1);
+    }
+    *ctx = defaults;
+    /* Settle the clock rate now, rather than in whichever threads
+       happen to measure first */
+    read_counter();
+    return ctx;
+}
 
+void fcyc_ctx_free(fcyc_ctx_t *ctx)
+{
+    free(ctx->cache_buf);
+    free(ctx->values);
 #if KEEP_SAMPLES
-static double *samples = NULL;
+    free(ctx->samples);
 #endif
+    free(ctx);
+}
 
 /* Initialize the minimum time threshold */
-static void init_min_time() {
-    if (min_time == 0.0)
-	min_time = min_ticks * timer_resolution;
+static void init_min_time(fcyc_ctx_t *ctx) {
+    if (ctx->min_time == 0.0)
+	ctx->min_time = ctx->min_ticks * timer_resolution;
 }
 
 /* Start new sampling process */
-static void init_sampler()
+static void init_sampler(fcyc_ctx_t *ctx)
 {
-    if (values)
-	free(values);
-    values = calloc(kbest, sizeof(double));
+    if (ctx->values)
+	free(ctx->values);
+    ctx->values = calloc(ctx->kbest, sizeof(double));
 #if KEEP_SAMPLES
-    if (samples)
-	free(samples);
+    if (ctx->samples)
+	free(ctx->samples);
     /* Allocate extra for wraparound analysis */
-    samples = calloc(maxsamples+kbest, sizeof(double));
+    ctx->samples = calloc(ctx->maxsamples+ctx->kbest, sizeof(double));
 #endif
-    samplecount = 0;
+    ctx->samplecount = 0;
 }
 
 /* Add new sample.  */
-static void add_sample(double val)
+static void add_sample(fcyc_ctx_t *ctx, double val)
 {
+    double *values = ctx->values;
+    long int kbest = ctx->kbest;
     long int pos = 0;
-    if (samplecount < kbest) {
-	pos = samplecount;
+    if (ctx->samplecount < kbest) {
+	pos = ctx->samplecount;
 	values[pos] = val;
     } else if (val < values[kbest-1]) {
 	pos = kbest-1;
 	values[pos] = val;
     }
 #if KEEP_SAMPLES
-    samples[samplecount] = val;
+    ctx->samples[ctx->samplecount] = val;
 #endif
-    samplecount++;
+    ctx->samplecount++;
     /* Insertion sort */
     while (pos > 0 && values[pos-1] > values[pos]) {
 	double temp = values[pos-1];
@@ -83,11 +143,11 @@ static void add_sample(double val)
 }
 
 /* Have kbest minimum measurements converged within epsilon? */
-static long int has_converged()
+static long int has_converged(fcyc_ctx_t *ctx)
 {
     return
-	(samplecount >= kbest) &&
-	((1 + epsilon)*values[0] >= values[kbest-1]);
+	(ctx->samplecount >= ctx->kbest) &&
+	((1 + ctx->epsilon)*ctx->values[0] >= ctx->values[ctx->kbest-1]);
 }
 
 /* Code to clear cache */
@@ -95,20 +155,22 @@ static long int has_converged()
 
 static volatile long int sink = 0;
 
-static void clear()
+static void clear(fcyc_ctx_t *ctx)
 {
     long int x = sink;
     long int *cptr, *cend;
-    long int incr = cache_block/sizeof(long int);
-    if (!cache_buf) {
-	cache_buf = malloc(cache_bytes);
-	if (!cache_buf) {
+    long int incr = ctx->cache_block/sizeof(long int);
+    if (!ctx->cache_buf) {
+	ctx->cache_buf = malloc(ctx->cache_bytes);
+	if (!ctx->cache_buf) {
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	/* Untouched pages all map the shared zero page, which evicts nothing */
+	memset(ctx->cache_buf, 0, ctx->cache_bytes);
     }
-    cptr = (long int *) cache_buf;
-    cend = cptr + cache_bytes/sizeof(long int);
+    cptr = (long int *) ctx->cache_buf;
+    cend = cptr + ctx->cache_bytes/sizeof(long int);
     while (cptr < cend) {
 	x += *cptr;
 	cptr += incr;
@@ -116,87 +178,259 @@ static void clear()
     sink = x;
 }
 
-double fcyc(test_funct f, void *args)
+/* Find the cache parameters from sysfs */
+#define SYS_CACHE_DIR "/sys/devices/system/cpu/cpu0/cache"
+
+/* Read the first line of file dir/index<idx>/name.  Returns 0 on failure */
+static int read_cache_attr(int idx, const char *name, char *buf, int len)
 {
-    double result;
-    long reps = min_reps;
+    char path[256];
+    FILE *fp;
+    int ok;
+    snprintf(path, sizeof(path), "%s/index%d/%s", SYS_CACHE_DIR, idx, name);
+    if ((fp = fopen(path, "r")) == NULL)
+	return 0;
+    ok = fgets(buf, len, fp) != NULL;
+    fclose(fp);
+    return ok;
+}
+
+int fcyc_detect_cache(long int *bytes, long int *block)
+{
+    char buf[64];
+    long int best = 0;
+    long int best_block = 0;
+    int idx;
+    for (idx = 0; read_cache_attr(idx, "size", buf, sizeof(buf)); idx++) {
+	char *suffix;
+	long int size = strtol(buf, &suffix, 10);
+	long int line = 0;
+	switch (*suffix) {
+	case 'K': size <<= 10; break;
+	case 'M': size <<= 20; break;
+	case 'G': size <<= 30; break;
+	}
+	/* Flushing the instruction cache isn't the point */
+	if (read_cache_attr(idx, "type", buf, sizeof(buf)) &&
+	    strncmp(buf, "Instruction", 11) == 0)
+	    continue;
+	if (read_cache_attr(idx, "coherency_line_size", buf, sizeof(buf)))
+	    line = strtol(buf, NULL, 10);
+	if (size > best && line > 0) {
+	    best = size;
+	    best_block = line;
+	}
+    }
+    if (best == 0)
+	return 0;
+    *bytes = best;
+    *block = best_block;
+    return 1;
+}
+
+/* Increase reps until get meaningful times */
+static long find_reps(fcyc_ctx_t *ctx, test_funct f, void *args)
+{
+    long reps = ctx->min_reps;
     long r;
-    double cyc;
-    /* Increase reps until get meaningful times */
+    double start;
     double sec = 0.0;
-    init_min_time();
-    while (sec < min_time) {
-	if (clear_cache)
-	    clear();
-	start_timer();
+    init_min_time(ctx);
+    while (sec < ctx->min_time) {
+	if (ctx->clear_cache)
+	    clear(ctx);
+	start = read_timer();
 	for (r = 0; r < reps; r++) {
 	    f(args);
 	}
-	sec = get_timer();
-	if (sec < min_time)
+	sec = read_timer() - start;
+	if (sec < ctx->min_time)
 	    reps += reps;
+	//	printf("uSecs = %.3f, reps = %ld\n", sec * 1e6, reps);
     }
-    init_sampler();
+    return reps;
+}
+
+double fcyc_r(fcyc_ctx_t *ctx, test_funct f, void *args)
+{
+    double result;
+    long reps = find_reps(ctx, f, args);
+    long r;
+    double start;
+    double cyc;
+    init_sampler(ctx);
     do {
-	if (clear_cache)
-	    clear();
-	start_counter();
+	if (ctx->clear_cache)
+	    clear(ctx);
+	start = read_counter();
 	for (r = 0; r < reps; r++) {
 	    f(args);
 	}
-	cyc = (double) get_counter() / reps;
+	cyc = (read_counter() - start) / reps;
 	if (cyc > 0.0)
-	    add_sample(cyc);
-    } while (!has_converged() && samplecount < maxsamples);
-    result = values[0];
+	    add_sample(ctx, cyc);
+    } while (!has_converged(ctx) && ctx->samplecount < ctx->maxsamples);
+    result = ctx->values[0];
 #if !KEEP_VALS
-    free(values); 
-    values = NULL;
+    free(ctx->values);
+    ctx->values = NULL;
 #endif
-    return result;  
+    return result;
 }
 
-double fsec(test_funct f, void *args)
+double fsec_r(fcyc_ctx_t *ctx, test_funct f, void *args)
 {
     double result;
-    /* Increase reps until get meaningful times */
-    long reps = min_reps;
+    long reps = find_reps(ctx, f, args);
     long r;
-    double sec = 0.0;
-    init_min_time();
-    while (sec < min_time) {
-	if (clear_cache)
-	    clear();
-	start_timer();
-	for (r = 0; r < reps; r++) {
-	    f(args);
-	}
-	sec = get_timer();
-	if (sec < min_time)
-	    reps += reps;
-	//	printf("uSecs = %.3f, reps = %ld\n", sec * 1e6, reps);
-    }
-    init_sampler();
+    double start;
+    double sec;
+    init_sampler(ctx);
     //    printf("\nuSecs (reps=%ld):", reps);
     do {
-	if (clear_cache)
-	    clear();
-	start_timer();
+	if (ctx->clear_cache)
+	    clear(ctx);
+	start = read_timer();
 	for (r = 0; r < reps; r++) {
 	    f(args);
 	}
-	sec = get_timer()/reps;
+	sec = (read_timer() - start)/reps;
 	//	printf(" %.3f", sec * 1e6);
 	if (sec > 0.0)
-	    add_sample(sec);
-    } while (!has_converged() && samplecount < maxsamples);
-    result = values[0];
+	    add_sample(ctx, sec);
+    } while (!has_converged(ctx) && ctx->samplecount < ctx->maxsamples);
+    result = ctx->values[0];
     //    printf(" --> %.3f\n", result * 1e6);
 #if !KEEP_VALS
-    free(values); 
-    values = NULL;
+    free(ctx->values);
+    ctx->values = NULL;
 #endif
-    return result;  
+    return result;
+}
+
+double fcyc(test_funct f, void *args)
+{
+    return fcyc_r(&default_ctx, f, args);
+}
+
+double fsec(test_funct f, void *args)
+{
+    return fsec_r(&default_ctx, f, args);
+}
+
+
+/* Robust measurement: keep every sample, and summarize with the median,
+   the median absolute deviation, and a bootstrap confidence interval */
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Median of n values.  Reorders the values */
+static double median_of(double *vals, long n)
+{
+    qsort(vals, n, sizeof(double), compare_doubles);
+    if (n % 2)
+	return vals[n/2];
+    return 0.5 * (vals[n/2 - 1] + vals[n/2]);
+}
+
+/* Deterministic generator for resampling (xorshift64*), so the same
+   samples always give the same interval */
+static uint64_t next_random(fcyc_ctx_t *ctx)
+{
+    ctx->rng_state ^= ctx->rng_state >> 12;
+    ctx->rng_state ^= ctx->rng_state << 25;
+    ctx->rng_state ^= ctx->rng_state >> 27;
+    return ctx->rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+/* Percentile bootstrap interval for the median of n samples */
+static void bootstrap_ci(fcyc_ctx_t *ctx, const double *vals, long n,
+			 double *lo, double *hi)
+{
+    long b, j;
+    long lo_pos, hi_pos;
+    double *resample = malloc(n * sizeof(double));
+    double *medians = malloc(BOOTSTRAP_RESAMPLES * sizeof(double));
+    if (!resample || !medians) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in bootstrap_ci\n");
+	exit(1);
+    }
+    ctx->rng_state = 0x9E3779B97F4A7C15ull;
+    for (b = 0; b < BOOTSTRAP_RESAMPLES; b++) {
+	for (j = 0; j < n; j++)
+	    resample[j] = vals[next_random(ctx) % n];
+	medians[b] = median_of(resample, n);
+    }
+    qsort(medians, BOOTSTRAP_RESAMPLES, sizeof(double), compare_doubles);
+    lo_pos = (long) (BOOTSTRAP_RESAMPLES * (1.0 - ctx->ci_level) / 2.0);
+    hi_pos = (long) (BOOTSTRAP_RESAMPLES * (1.0 + ctx->ci_level) / 2.0);
+    if (hi_pos >= BOOTSTRAP_RESAMPLES)
+	hi_pos = BOOTSTRAP_RESAMPLES - 1;
+    *lo = medians[lo_pos];
+    *hi = medians[hi_pos];
+    free(resample);
+    free(medians);
+}
+
+double fsec_stats_r(fcyc_ctx_t *ctx, test_funct f, void *args, fcyc_stats_t *stats)
+{
+    long maxsamples = ctx->maxsamples > 0 ? ctx->maxsamples : 1;
+    long reps = find_reps(ctx, f, args);
+    long r, i, attempt;
+    long n = 0;
+    double start;
+    double sec;
+    double *vals = calloc(maxsamples, sizeof(double));
+    double *scratch = calloc(maxsamples, sizeof(double));
+    if (!vals || !scratch) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in fsec_stats\n");
+	exit(1);
+    }
+    stats->converged = 0;
+    for (attempt = 0; attempt < ctx->maxsamples && !stats->converged; attempt++) {
+	if (ctx->clear_cache)
+	    clear(ctx);
+	start = read_timer();
+	for (r = 0; r < reps; r++) {
+	    f(args);
+	}
+	sec = (read_timer() - start)/reps;
+	if (sec <= 0.0)
+	    continue;
+	vals[n++] = sec;
+	if (n < MIN_ROBUST_SAMPLES)
+	    continue;
+	memcpy(scratch, vals, n * sizeof(double));
+	stats->median = median_of(scratch, n);
+	bootstrap_ci(ctx, vals, n, &stats->ci_lo, &stats->ci_hi);
+	stats->converged = (stats->ci_hi - stats->ci_lo) <= ctx->ci_width * stats->median;
+    }
+    stats->samples = n;
+    if (n == 0) {
+	stats->median = stats->mad = stats->ci_lo = stats->ci_hi = 0.0;
+    } else {
+	memcpy(scratch, vals, n * sizeof(double));
+	stats->median = median_of(scratch, n);
+	bootstrap_ci(ctx, vals, n, &stats->ci_lo, &stats->ci_hi);
+	for (i = 0; i < n; i++) {
+	    double dev = vals[i] - stats->median;
+	    scratch[i] = dev < 0 ? -dev : dev;
+	}
+	stats->mad = median_of(scratch, n);
+    }
+    free(vals);
+    free(scratch);
+    return stats->median;
+}
+
+double fsec_stats(test_funct f, void *args, fcyc_stats_t *stats)
+{
+    return fsec_stats_r(&default_ctx, f, args, stats);
 }
 
 
@@ -205,70 +439,133 @@ double fsec(test_funct f, void *args)
 
 
 /* Sets minimum number of timer ticks to resolve time.  Default = 100 */
-void set_fcyc_min_ticks(int t) {
-    min_ticks = t;
+void set_fcyc_min_ticks_r(fcyc_ctx_t *ctx, int t) {
+    ctx->min_ticks = t;
+    /* Recompute the threshold on next use */
+    ctx->min_time = 0;
 }
 
 /* Sets minimum number of repetitions of function.  Default = 8 */
-void set_fcyc_min_reps(int r) {
-    min_reps = r;
+void set_fcyc_min_reps_r(fcyc_ctx_t *ctx, int r) {
+    ctx->min_reps = r;
 }
 
-/* When set, will run code to clear cache before each measurement 
+/* When set, will run code to clear cache before each measurement
    Default = 0
 */
-void set_fcyc_clear_cache(int clear)
+void set_fcyc_clear_cache_r(fcyc_ctx_t *ctx, int clear)
 {
-    clear_cache = clear;
+    ctx->clear_cache = clear;
 }
 
-/* Set size of cache to use when clearing cache 
+/* Set size of cache to use when clearing cache
    Default = 1<<19 (512KB)
 */
-void set_fcyc_cache_size(long int bytes)
+void set_fcyc_cache_size_r(fcyc_ctx_t *ctx, long int bytes)
 {
-    if (bytes != cache_bytes) {
-	cache_bytes = bytes;
-	if (cache_buf) {
-	    free(cache_buf);
-	    cache_buf = NULL;
+    if (bytes != ctx->cache_bytes) {
+	ctx->cache_bytes = bytes;
+	if (ctx->cache_buf) {
+	    free(ctx->cache_buf);
+	    ctx->cache_buf = NULL;
 	}
     }
 }
 
-/* Set size of cache block 
+/* Set size of cache block
    Default = 32
 */
-void set_fcyc_cache_block(long int bytes) {
-    cache_block = bytes;
+void set_fcyc_cache_block_r(fcyc_ctx_t *ctx, long int bytes) {
+    ctx->cache_block = bytes;
 }
 
 /* Value of K in K-best
    Default = 3
 */
-void set_fcyc_k(long int k)
+void set_fcyc_k_r(fcyc_ctx_t *ctx, long int k)
 {
-    kbest = k;
+    ctx->kbest = k;
 }
 
 /* Maximum number of samples attempting to find K-best within some tolerance.
    When exceeded, just return best sample found.
    Default = 20
 */
-void set_fcyc_maxsamples(long int maxsamples_arg)
+void set_fcyc_maxsamples_r(fcyc_ctx_t *ctx, long int maxsamples_arg)
 {
-    maxsamples = maxsamples_arg;
+    ctx->maxsamples = maxsamples_arg;
 }
 
 /* Tolerance required for K-best
    Default = 0.01
 */
-void set_fcyc_epsilon(double epsilon_arg)
+void set_fcyc_epsilon_r(fcyc_ctx_t *ctx, double epsilon_arg)
 {
-    epsilon = epsilon_arg;
+    ctx->epsilon = epsilon_arg;
 }
 
+/* Width of the confidence interval, relative to the median, at which
+   fsec_stats stops sampling.
+   Default = 0.01
+*/
+void set_fcyc_ci_width_r(fcyc_ctx_t *ctx, double width)
+{
+    ctx->ci_width = width;
+}
 
+/* Confidence level of the interval computed by fsec_stats
+   Default = 0.95
+*/
+void set_fcyc_ci_level_r(fcyc_ctx_t *ctx, double level)
+{
+    ctx->ci_level = level;
+}
 
+/* Setters for the default context */
 
+void set_fcyc_min_ticks(int t) {
+    set_fcyc_min_ticks_r(&default_ctx, t);
+}
 
+void set_fcyc_min_reps(int r) {
+    set_fcyc_min_reps_r(&default_ctx, r);
+}
+
+void set_fcyc_clear_cache(int clear)
+{
+    set_fcyc_clear_cache_r(&default_ctx, clear);
+}
+
+void set_fcyc_cache_size(long int bytes)
+{
+    set_fcyc_cache_size_r(&default_ctx, bytes);
+}
+
+void set_fcyc_cache_block(long int bytes) {
+    set_fcyc_cache_block_r(&default_ctx, bytes);
+}
+
+void set_fcyc_k(long int k)
+{
+    set_fcyc_k_r(&default_ctx, k);
+}
+
+void set_fcyc_maxsamples(long int maxsamples_arg)
+{
+    set_fcyc_maxsamples_r(&default_ctx, maxsamples_arg);
+}
+
+void set_fcyc_epsilon(double epsilon_arg)
+{
+    set_fcyc_epsilon_r(&default_ctx, epsilon_arg);
+}
+
+void set_fcyc_ci_width(double width)
+{
+    set_fcyc_ci_width_r(&default_ctx, width);
+}
+
+void set_fcyc_ci_level(double level)
+{
+    set_fcyc_ci_level_r(&default_ctx, level);
+}
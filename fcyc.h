@@ -14,6 +14,23 @@ double fcyc(test_funct f, void* args);
 /* Compute number of cycles used by function f on given set of parameters */
 double fsec(test_funct f, void* args);
 
+/* Robust summary of a measurement, in seconds */
+typedef struct {
+    double median;      /* median of all samples */
+    double mad;         /* median absolute deviation from the median */
+    double ci_lo;       /* bootstrap confidence interval for the median */
+    double ci_hi;
+    long samples;       /* number of samples taken */
+    int converged;      /* did the interval get narrow enough? */
+} fcyc_stats_t;
+
+/* Compute number of seconds used by function f, keeping every sample
+   rather than the K best.  Sampling stops once the bootstrap confidence
+   interval for the median is narrower than the target width, or after
+   the maximum number of samples, in which case stats->converged is 0.
+   Returns the median */
+double fsec_stats(test_funct f, void* args, fcyc_stats_t *stats);
+
 /***********************************************************/
 /* Set the various parameters used by measurement routines */
 
@@ -38,6 +55,11 @@ void set_fcyc_cache_size(long int bytes);
 */
 void set_fcyc_cache_block(long int bytes);
 
+/* Find the size of the largest data or unified cache, and its line
+   size, from /sys/devices/system/cpu/cpu0/cache.  Returns 0, leaving
+   bytes and block alone, if the information isn't available */
+int fcyc_detect_cache(long int *bytes, long int *block);
+
 /* When set, will attempt to compensate for timer interrupt overhead 
    Default = 0
 */
@@ -59,5 +81,47 @@ void set_fcyc_maxsamples(long int maxsamples);
 */
 void set_fcyc_epsilon(double epsilon);
 
+/* Width of the confidence interval, relative to the median, at which
+   fsec_stats stops sampling.
+   Default = 0.01
+*/
+void set_fcyc_ci_width(double width);
+
+/* Confidence level of the interval computed by fsec_stats
+   Default = 0.95
+*/
+void set_fcyc_ci_level(double level);
 
 
+/***********************************************************/
+/* Reentrant measurement.  A context carries its own parameters,
+   samples, and cache-clearing buffer, so measurements in different
+   contexts may run concurrently in separate threads.  The routines
+   above all use a single default context.  Each routine below takes
+   the context as its first argument and otherwise matches the
+   routine of the same name without the _r suffix. */
+
+typedef struct fcyc_ctx fcyc_ctx_t;
+
+/* Create a context with all parameters at their defaults.  Create
+   contexts before starting the threads that use them: the first one
+   settles the clock rate that all of them share */
+fcyc_ctx_t *fcyc_ctx_new(void);
+
+/* Release a context and its buffers */
+void fcyc_ctx_free(fcyc_ctx_t *ctx);
+
+double fcyc_r(fcyc_ctx_t *ctx, test_funct f, void* args);
+double fsec_r(fcyc_ctx_t *ctx, test_funct f, void* args);
+double fsec_stats_r(fcyc_ctx_t *ctx, test_funct f, void* args, fcyc_stats_t *stats);
+
+void set_fcyc_min_ticks_r(fcyc_ctx_t *ctx, int t);
+void set_fcyc_min_reps_r(fcyc_ctx_t *ctx, int r);
+void set_fcyc_clear_cache_r(fcyc_ctx_t *ctx, int clear);
+void set_fcyc_cache_size_r(fcyc_ctx_t *ctx, long int bytes);
+void set_fcyc_cache_block_r(fcyc_ctx_t *ctx, long int bytes);
+void set_fcyc_k_r(fcyc_ctx_t *ctx, long int k);
+void set_fcyc_maxsamples_r(fcyc_ctx_t *ctx, long int maxsamples);
+void set_fcyc_epsilon_r(fcyc_ctx_t *ctx, double epsilon);
+void set_fcyc_ci_width_r(fcyc_ctx_t *ctx, double width);
+void set_fcyc_ci_level_r(fcyc_ctx_t *ctx, double level);
@@ -0,0 +1,92 @@
+/*
+ * Log-linear histograms.
+ *
+ * Values below HIST_SUB_COUNT get a bucket each.  A larger value v with
+ * its most significant bit at position e lands in group e-HIST_SUB_BITS+1,
+ * whose HIST_SUB_COUNT buckets each cover 2^(e-HIST_SUB_BITS) values.
+ */
+#include <string.h>
+#include <math.h>
+
+#include "hist.h"
+
+/* Position of most significant 1 bit.  Requires v != 0 */
+static int msb(uint64_t v) {
+    return 63 - __builtin_clzll(v);
+}
+
+static int bucket_index(uint64_t v) {
+    if (v < HIST_SUB_COUNT)
+	return (int) v;
+    int shift = msb(v) - HIST_SUB_BITS;
+    int sub = (int) (v >> shift) - HIST_SUB_COUNT;
+    return (shift + 1) * HIST_SUB_COUNT + sub;
+}
+
+/* Largest value that maps to bucket idx */
+static uint64_t bucket_upper(int idx) {
+    int group = idx / HIST_SUB_COUNT;
+    uint64_t sub = idx % HIST_SUB_COUNT;
+    if (group == 0)
+	return sub;
+    int shift = group - 1;
+    uint64_t lower = (HIST_SUB_COUNT + sub) << shift;
+    return lower + (((uint64_t) 1 << shift) - 1);
+}
+
+void hist_init(hist_t *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void hist_record(hist_t *h, uint64_t val) {
+    h->buckets[bucket_index(val)]++;
+    h->count++;
+    h->sum += (double) val;
+    if (val < h->min)
+	h->min = val;
+    if (val > h->max)
+	h->max = val;
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+    int i;
+    if (src->count == 0)
+	return;
+    for (i = 0; i < HIST_BUCKETS; i++)
+	dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+	dst->min = src->min;
+    if (src->max > dst->max)
+	dst->max = src->max;
+}
+
+uint64_t hist_percentile(const hist_t *h, double pct) {
+    int i;
+    uint64_t seen = 0;
+    uint64_t rank;
+    if (h->count == 0)
+	return 0;
+    rank = (uint64_t) ceil(pct / 100.0 * (double) h->count);
+    if (rank < 1)
+	rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	seen += h->buckets[i];
+	if (seen >= rank) {
+	    uint64_t val = bucket_upper(i);
+	    /* Never report beyond what was actually seen */
+	    if (val > h->max)
+		val = h->max;
+	    if (val < h->min)
+		val = h->min;
+	    return val;
+	}
+    }
+    return h->max;
+}
+
+double hist_mean(const hist_t *h) {
+    return h->count == 0 ? 0.0 : h->sum / (double) h->count;
+}
@@ -0,0 +1,36 @@
+/*
+ * Log-linear (HDR-style) histograms of nonnegative 64-bit values.
+ *
+ * Each power of two is split into HIST_SUB_COUNT equal-width
+ * sub-buckets, so any recorded value can be reported with a relative
+ * error of at most 1/HIST_SUB_COUNT, no matter how large it is.
+ */
+#include <stdint.h>
+
+#define HIST_SUB_BITS  5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS   ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct {
+    uint64_t count;     /* number of recorded values */
+    uint64_t min;       /* smallest recorded value */
+    uint64_t max;       /* largest recorded value */
+    double sum;         /* sum of recorded values, for the mean */
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+/* Clear all recorded values */
+void hist_init(hist_t *h);
+
+/* Record one value */
+void hist_record(hist_t *h, uint64_t val);
+
+/* Add all values recorded in src to dst */
+void hist_merge(hist_t *dst, const hist_t *src);
+
+/* Value at or below which pct percent of the recorded values lie.
+   Returns 0 for an empty histogram */
+uint64_t hist_percentile(const hist_t *h, double pct);
+
+/* Mean of the recorded values.  Returns 0 for an empty histogram */
+double hist_mean(const hist_t *h);
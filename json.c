@@ -0,0 +1,365 @@
+/*
+ * JSON reader.
+ *
+ * A recursive descent parser over a NUL-terminated buffer.  \u escapes
+ * are decoded to UTF-8, without pairing surrogates, which the driver
+ * never writes.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+#include "json.h"
+
+#define JSON_MAXDEPTH 64
+
+typedef struct {
+    const char *text;       /* start of input, for error positions */
+    const char *pos;        /* next character to parse */
+    char *err;
+    size_t errlen;
+    int depth;
+} json_parser_t;
+
+static json_value_t *parse_value(json_parser_t *p);
+
+static void parse_error(json_parser_t *p, const char *fmt, ...) {
+    va_list ap;
+    int line = 1;
+    const char *s;
+    /* Only the first error is reported */
+    if (p->err[0] != 0)
+	return;
+    for (s = p->text; s < p->pos; s++)
+	if (*s == '\n')
+	    line++;
+    snprintf(p->err, p->errlen, "line %d: ", line);
+    va_start(ap, fmt);
+    vsnprintf(p->err + strlen(p->err), p->errlen - strlen(p->err), fmt, ap);
+    va_end(ap);
+}
+
+static void skip_space(json_parser_t *p) {
+    while (isspace((unsigned char) *p->pos))
+	p->pos++;
+}
+
+static json_value_t *new_value(json_type_t type) {
+    json_value_t *v = calloc(1, sizeof(json_value_t));
+    if (v != NULL)
+	v->type = type;
+    return v;
+}
+
+/* Append an element, or a member if key is non-NULL */
+static int append(json_value_t *v, char *key, json_value_t *item) {
+    json_value_t **items = realloc(v->items, (v->count + 1) * sizeof(*items));
+    if (items == NULL)
+	return 0;
+    v->items = items;
+    if (v->type == JSON_OBJECT) {
+	char **keys = realloc(v->keys, (v->count + 1) * sizeof(*keys));
+	if (keys == NULL)
+	    return 0;
+	v->keys = keys;
+	v->keys[v->count] = key;
+    }
+    v->items[v->count++] = item;
+    return 1;
+}
+
+static void put_utf8(char **out, unsigned code) {
+    char *o = *out;
+    if (code < 0x80) {
+	*o++ = (char) code;
+    } else if (code < 0x800) {
+	*o++ = (char) (0xC0 | (code >> 6));
+	*o++ = (char) (0x80 | (code & 0x3F));
+    } else {
+	*o++ = (char) (0xE0 | (code >> 12));
+	*o++ = (char) (0x80 | ((code >> 6) & 0x3F));
+	*o++ = (char) (0x80 | (code & 0x3F));
+    }
+    *out = o;
+}
+
+/* Parse a string starting at its opening quote.  Returns a malloc'd copy */
+static char *parse_string(json_parser_t *p) {
+    const char *s;
+    char *buf, *o;
+    size_t len = 0;
+
+    /* Escapes never expand, so the raw length bounds the result */
+    for (s = p->pos + 1; *s != '"'; s++) {
+	if (*s == 0) {
+	    parse_error(p, "unterminated string");
+	    return NULL;
+	}
+	if (*s == '\\' && s[1] != 0)
+	    s++;
+	len++;
+    }
+    if ((buf = malloc(len * 3 + 1)) == NULL) {
+	parse_error(p, "out of memory");
+	return NULL;
+    }
+    o = buf;
+    for (s = p->pos + 1; *s != '"'; s++) {
+	if (*s != '\\') {
+	    *o++ = *s;
+	    continue;
+	}
+	switch (*++s) {
+	case '"': case '\\': case '/':
+	    *o++ = *s;
+	    break;
+	case 'b': *o++ = '\b'; break;
+	case 'f': *o++ = '\f'; break;
+	case 'n': *o++ = '\n'; break;
+	case 'r': *o++ = '\r'; break;
+	case 't': *o++ = '\t'; break;
+	case 'u': {
+	    unsigned code;
+	    char hex[5];
+	    char *end;
+	    memcpy(hex, s + 1, 4);
+	    hex[4] = 0;
+	    code = (unsigned) strtoul(hex, &end, 16);
+	    if (end != hex + 4) {
+		p->pos = s;
+		parse_error(p, "bad \\u escape");
+		free(buf);
+		return NULL;
+	    }
+	    put_utf8(&o, code);
+	    s += 4;
+	    break;
+	}
+	default:
+	    p->pos = s;
+	    parse_error(p, "bad escape '\\%c'", *s);
+	    free(buf);
+	    return NULL;
+	}
+    }
+    *o = 0;
+    p->pos = s + 1;
+    return buf;
+}
+
+static json_value_t *parse_container(json_parser_t *p, json_type_t type) {
+    char close = type == JSON_OBJECT ? '}' : ']';
+    json_value_t *v = new_value(type);
+    if (v == NULL) {
+	parse_error(p, "out of memory");
+	return NULL;
+    }
+    if (++p->depth > JSON_MAXDEPTH) {
+	parse_error(p, "nested too deeply");
+	json_free(v);
+	return NULL;
+    }
+    p->pos++;
+    skip_space(p);
+    if (*p->pos == close) {
+	p->pos++;
+	p->depth--;
+	return v;
+    }
+    while (1) {
+	char *key = NULL;
+	json_value_t *item;
+	if (type == JSON_OBJECT) {
+	    skip_space(p);
+	    if (*p->pos != '"') {
+		parse_error(p, "expected member name");
+		json_free(v);
+		return NULL;
+	    }
+	    if ((key = parse_string(p)) == NULL) {
+		json_free(v);
+		return NULL;
+	    }
+	    skip_space(p);
+	    if (*p->pos != ':') {
+		parse_error(p, "expected ':' after \"%s\"", key);
+		free(key);
+		json_free(v);
+		return NULL;
+	    }
+	    p->pos++;
+	}
+	if ((item = parse_value(p)) == NULL || !append(v, key, item)) {
+	    parse_error(p, "out of memory");
+	    free(key);
+	    json_free(item);
+	    json_free(v);
+	    return NULL;
+	}
+	skip_space(p);
+	if (*p->pos == ',') {
+	    p->pos++;
+	} else if (*p->pos == close) {
+	    p->pos++;
+	    p->depth--;
+	    return v;
+	} else {
+	    parse_error(p, "expected ',' or '%c'", close);
+	    json_free(v);
+	    return NULL;
+	}
+    }
+}
+
+static json_value_t *parse_value(json_parser_t *p) {
+    json_value_t *v = NULL;
+    skip_space(p);
+    switch (*p->pos) {
+    case '{':
+	return parse_container(p, JSON_OBJECT);
+    case '[':
+	return parse_container(p, JSON_ARRAY);
+    case '"': {
+	char *s = parse_string(p);
+	if (s == NULL)
+	    return NULL;
+	if ((v = new_value(JSON_STRING)) == NULL) {
+	    free(s);
+	    break;
+	}
+	v->string = s;
+	return v;
+    }
+    default:
+	if (strncmp(p->pos, "true", 4) == 0 || strncmp(p->pos, "false", 5) == 0) {
+	    if ((v = new_value(JSON_BOOL)) == NULL)
+		break;
+	    v->number = *p->pos == 't';
+	    p->pos += *p->pos == 't' ? 4 : 5;
+	    return v;
+	}
+	if (strncmp(p->pos, "null", 4) == 0) {
+	    p->pos += 4;
+	    if ((v = new_value(JSON_NULL)) == NULL)
+		break;
+	    return v;
+	}
+	if (*p->pos == '-' || isdigit((unsigned char) *p->pos)) {
+	    char *end;
+	    double num = strtod(p->pos, &end);
+	    if ((v = new_value(JSON_NUMBER)) == NULL)
+		break;
+	    v->number = num;
+	    p->pos = end;
+	    return v;
+	}
+	parse_error(p, *p->pos ? "unexpected '%c'" : "unexpected end of input%c", *p->pos);
+	return NULL;
+    }
+    parse_error(p, "out of memory");
+    return NULL;
+}
+
+json_value_t *json_parse(const char *text, char *err, size_t errlen) {
+    json_parser_t p;
+    json_value_t *v;
+    p.text = p.pos = text;
+    p.err = err;
+    p.errlen = errlen;
+    p.depth = 0;
+    err[0] = 0;
+    if ((v = parse_value(&p)) == NULL)
+	return NULL;
+    skip_space(&p);
+    if (*p.pos != 0) {
+	parse_error(&p, "trailing characters after value");
+	json_free(v);
+	return NULL;
+    }
+    return v;
+}
+
+json_value_t *json_read_file(const char *path, char *err, size_t errlen) {
+    FILE *f;
+    char *text;
+    long len;
+    json_value_t *v;
+
+    if ((f = fopen(path, "r")) == NULL) {
+	snprintf(err, errlen, "could not open '%s'", path);
+	return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 ||
+	fseek(f, 0, SEEK_SET) != 0 || (text = malloc(len + 1)) == NULL) {
+	snprintf(err, errlen, "could not read '%s'", path);
+	fclose(f);
+	return NULL;
+    }
+    if (fread(text, 1, len, f) != (size_t) len) {
+	snprintf(err, errlen, "could not read '%s'", path);
+	free(text);
+	fclose(f);
+	return NULL;
+    }
+    text[len] = 0;
+    fclose(f);
+    v = json_parse(text, err, errlen);
+    free(text);
+    return v;
+}
+
+json_value_t *json_get(const json_value_t *obj, const char *key) {
+    int i;
+    if (obj == NULL || obj->type != JSON_OBJECT)
+	return NULL;
+    for (i = 0; i < obj->count; i++)
+	if (strcmp(obj->keys[i], key) == 0)
+	    return obj->items[i];
+    return NULL;
+}
+
+double json_number(const json_value_t *v, double dflt) {
+    if (v == NULL || (v->type != JSON_NUMBER && v->type != JSON_BOOL))
+	return dflt;
+    return v->number;
+}
+
+const char *json_string(const json_value_t *v, const char *dflt) {
+    if (v == NULL || v->type != JSON_STRING)
+	return dflt;
+    return v->string;
+}
+
+void json_free(json_value_t *v) {
+    int i;
+    if (v == NULL)
+	return;
+    for (i = 0; i < v->count; i++) {
+	if (v->keys)
+	    free(v->keys[i]);
+	json_free(v->items[i]);
+    }
+    free(v->keys);
+    free(v->items);
+    free(v->string);
+    free(v);
+}
+
+void json_write_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+	unsigned char c = (unsigned char) *s;
+	if (c == '"' || c == '\\')
+	    fprintf(f, "\\%c", c);
+	else if (c == '\n')
+	    fputs("\\n", f);
+	else if (c == '\t')
+	    fputs("\\t", f);
+	else if (c < 0x20)
+	    fprintf(f, "\\u%04x", c);
+	else
+	    fputc(c, f);
+    }
+    fputc('"', f);
+}
@@ -0,0 +1,41 @@
+/*
+ * A small JSON reader, enough to load results written by the driver.
+ *
+ * Values are parsed into a tree of json_value_t.  Lookups on a missing
+ * member or a value of the wrong type return the caller's default, so
+ * optional fields need no special handling.
+ */
+#include <stdio.h>
+#include <stddef.h>
+
+typedef enum {
+    JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT
+} json_type_t;
+
+typedef struct json_value {
+    json_type_t type;
+    double number;               /* JSON_NUMBER; 0 or 1 for JSON_BOOL */
+    char *string;                /* JSON_STRING */
+    int count;                   /* number of array elements or members */
+    char **keys;                 /* JSON_OBJECT member names */
+    struct json_value **items;   /* array elements or member values */
+} json_value_t;
+
+/* Parse a whole file.  Returns NULL, with a message in err, on error */
+json_value_t *json_read_file(const char *path, char *err, size_t errlen);
+
+/* Parse a string.  Returns NULL, with a message in err, on error */
+json_value_t *json_parse(const char *text, char *err, size_t errlen);
+
+/* Member key of an object, or NULL */
+json_value_t *json_get(const json_value_t *obj, const char *key);
+
+/* Value as a number or string, or dflt if it is missing or another type */
+double json_number(const json_value_t *v, double dflt);
+const char *json_string(const json_value_t *v, const char *dflt);
+
+/* Free a parsed tree */
+void json_free(json_value_t *v);
+
+/* Write s as a quoted, escaped JSON string */
+void json_write_string(FILE *f, const char *s);
@@ -8,6 +8,7 @@
  * reserved.  May not be used, modified, or copied without permission.
  */
 #include <assert.h>
+#include <dlfcn.h>
 #include <errno.h>
 #include <float.h>
 #include <setjmp.h>
@@ -19,13 +20,20 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
+#include <sys/resource.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fcyc.h"
 #include "config.h"
 #include "stree.h"
+#include "clock.h"
+#include "hist.h"
+#include "perfctr.h"
+#include "refmm.h"
+#include "json.h"
 
 /**********************
  * Constants and macros
@@ -36,16 +44,58 @@
 #define HDRLINES       4          /* number of header lines in a trace file */
 #define LINENUM(i) (i+HDRLINES+1) /* cnvt trace request nums to linenums (origin 1) */
 
-#ifndef REF_ONLY
-#define REF_ONLY 0
-#endif
-
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
 /* weights */
 typedef enum { WNONE, WALL, WUTIL, WPERF } weight_t;
 
+/* Latency measurement */
+#define LAT_PASSES     3          /* replays of each trace in the latency pass */
+#define LAT_OPTYPES    3          /* malloc, free, realloc */
+#define LAT_CLASSES    5          /* request size classes, see lat_class_limit */
+
+/* Windowed timing (-W) */
+#define WIN_PASSES     5          /* replays; each window keeps its fastest time */
+#define WIN_TOP        5          /* slowest windows reported per trace */
+
+/* Payload access simulation (-x) */
+#define ACCESS_WRITE_MAX 4096     /* bytes written into each new payload */
+#define ACCESS_RECENT      64     /* newest live blocks, for the locality model */
+#define ACCESS_LOCAL      0.9     /* fraction of reads that go to those */
+
+/* Locality metrics (-g) */
+#define LOC_SAMPLES       100     /* snapshots of the live set per trace */
+#define LOC_PAGE         4096
+#define LOC_LINE           64
+
+/* Memory accounting (-r) */
+#define HUGE_SAMPLE_MIN (2 << 20) /* heap size of the first huge page sample */
+
+/* Robust timing (-R): stop after this many samples, even if the
+   confidence interval is not yet narrow enough */
+#define ROBUST_MAXSAMPLES 100
+
+/* Cold-cache timing reads a buffer this many times the size of the
+   largest cache between samples */
+#define FLUSH_FACTOR 2
+
+/* Mixed replay (-m) */
+#define MIX_SEED     1            /* seed for the random interleavings */
+
+/* A/B comparison */
+#define AB_ROUNDS      10         /* default number of ABAB timing rounds */
+#define AB_FLIPS    20000         /* random sign flips in the significance test */
+#define AB_ALPHA     0.05         /* significance level */
+
+/* Default number of requests per row of the utilization timeline (-u) */
+#define UTIL_WINDOW 1000
+
+/* Default tolerances for regressions against a baseline (-b), as
+   fractions of the baseline value */
+#define KOPS_TOLERANCE 0.10
+#define UTIL_TOLERANCE 0.005
+
 /******************************
  * The key compound data types
  *****************************/
@@ -98,6 +148,25 @@ typedef struct {
     int *block_rand_base; /* index into random_data, if debug is on */
 } trace_t;
 
+/*
+ * Entry points of an allocator loaded from a shared object, together
+ * with those of the private copy of memlib built into it
+ */
+typedef struct {
+    char name[MAXLINE];
+    void *handle;
+    bool (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*mem_init)(void);
+    void (*mem_deinit)(void);
+    void (*mem_reset_brk)(void);
+    void *(*mem_heap_lo)(void);
+    void *(*mem_heap_hi)(void);
+    bool (*mem_is_mapped)(const void *lo, const void *hi); /* NULL if absent */
+} allocator_t;
+
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
  * This struct is necessary because fcyc accepts only a pointer array
@@ -106,8 +175,21 @@ typedef struct {
 typedef struct {
     trace_t *trace;
     range_set_t *ranges;
+    allocator_t *alloc;   /* allocator for eval_alloc_speed */
+    long runs;            /* number of times the trace has been replayed */
+    int *live;            /* live ids, for eval_mm_speed_access ... */
+    int *live_pos;        /* ... and each id's position in live */
 } speed_t;
 
+/* Percentiles of the per-call latencies for one kind of call, in cycles */
+typedef struct {
+    double count;      /* number of calls measured */
+    double p50;
+    double p99;
+    double p999;
+    double max;
+} lat_summary_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -121,6 +203,54 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
+    double heap_peak;  /* largest heap size during the trace */
+    double heap_final; /* heap size at its end, less if mm gave memory back */
+
+    /* defined only when the latency pass was run (-L) */
+    bool lat_valid;
+    lat_summary_t lat[LAT_OPTYPES];                   /* indexed by op type */
+    lat_summary_t lat_class[LAT_OPTYPES][LAT_CLASSES];/* ... and size class */
+
+    /* defined only when the windowed timing pass was run (-W) */
+    bool win_valid;
+    long num_windows;
+    double *win_cycles;   /* cycles per op in each window of win_ops ops */
+
+    /* defined only when performance counters were read (-P) */
+    bool perf_valid;
+    double perf[PC_NUM];  /* events per op; negative if unavailable */
+
+    /* defined only in robust timing mode (-R), where secs is the median */
+    bool robust_valid;
+    double mad;           /* median absolute deviation of the samples */
+    double ci_lo;         /* confidence interval for the median */
+    double ci_hi;
+    long samples;         /* number of samples taken */
+    bool converged;       /* did the interval reach the target width? */
+
+    /* defined only when memory use was measured (-r) */
+    bool mem_valid;
+    double resident;      /* heap bytes in physical memory after the trace */
+    double huge;          /* most heap bytes on huge pages as it grew */
+    double faults_first;  /* minor faults in the first replay on a fresh heap */
+    double faults_timed;  /* ... and per replay while timing */
+
+    /* defined only when the locality pass was run (-g).  Spread is the
+       number of pages or lines the live blocks touch, over the fewest
+       that could hold the live bytes */
+    bool loc_valid;
+    double page_spread_avg;
+    double page_spread_max;
+    double line_spread_avg;
+    double line_spread_max;
+
+    /* defined only when also timed with payload accesses (-x) */
+    bool access_valid;
+    double secs_access;   /* seconds per replay, including the accesses */
+
+    /* defined only when also timed with cold caches (-C) */
+    bool cold_valid;
+    double secs_cold;     /* seconds per replay, starting with flushed caches */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -131,6 +261,7 @@ typedef struct {
     double ops;   /* total number of operations */
     double secs;  /* total number of elapsed seconds */
     double tput;  /* average throughput expressed in Kops/s */
+    double cpo;   /* average cost in cycles per operation */
 } sum_stats_t;
 
 /********************
@@ -155,13 +286,46 @@ static randint_t random_data[RANDOM_DATA_LEN];
 /* Global values */
 typedef enum { DBG_NONE, DBG_CHEAP, DBG_EXPENSIVE } debug_mode_t; 
 
-static debug_mode_t debug_mode = REF_ONLY ? DBG_NONE : DBG_CHEAP;
-int verbose = REF_ONLY ? 0 : 1;  /* global flag for verbose output */
+static debug_mode_t debug_mode = DBG_CHEAP;
+int verbose = 1;                 /* global flag for verbose output */
 static int errors = 0;           /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
+static bool latency_mode = false; /* Run the per-call latency pass */
+static long win_ops = 0;          /* Requests per timed window; 0 if off */
+static double cycle_mhz = 0.0;    /* Cycle rate used to report cycles per op */
+static bool perf_mode = false;    /* Read performance counters while timing */
+static perf_counters_t perf_counters;
+static bool robust_mode = false;  /* Time with medians and confidence intervals */
+static bool cold_mode = false;    /* Also time each trace with cold caches */
+static fcyc_ctx_t *cold_ctx = NULL;
+static double access_reads = 0;   /* Payload reads per request (-x); 0 if off */
+static bool locality_mode = false; /* Measure the spread of the live set (-g) */
+static bool mem_mode = false;      /* Measure resident memory and faults (-r) */
+static bool heap_hugepage = false; /* Advise THP on the heap (-H) */
+static bool heap_align = false;    /* Align the heap base to 2MB (-G) */
+static size_t heap_populate = 0;   /* Bytes of heap to pre-fault (-p) */
+static char *ab_files[2] = { NULL, NULL };   /* shared objects to compare */
+static int ab_rounds = AB_ROUNDS;
+static int age_passes = 0;          /* passes on one aged heap; 0 if off */
+static char *mix_mode = NULL;       /* how to interleave a mixed replay */
+static char *json_file = NULL;      /* write results as JSON here */
+static FILE *json_stdout = NULL;    /* the real stdout, for -j - */
+static char *baseline_file = NULL;  /* JSON results to check for regressions */
+static double kops_tolerance = KOPS_TOLERANCE;
+static FILE *util_csv = NULL;       /* utilization timeline, if requested */
+static long util_window = UTIL_WINDOW;
 static size_t maxfill = MAXFILL;
 
+/* The reference allocator, on the same simulated heap as mm */
+static allocator_t ref_alloc = {
+    "reference", NULL, ref_init, ref_malloc, ref_free, ref_realloc,
+    mem_init, mem_deinit, mem_reset_brk, mem_heap_lo, mem_heap_hi, mem_is_mapped
+};
+static bool ref_calibrate = false;  /* Time ref_alloc right after mm on each trace */
+static double ref_secs = 0.0;       /* ... and the totals over throughput traces */
+static double ref_ops = 0.0;
+
 /* by default, no timeouts */
 static int set_timeout = 0;
 
@@ -175,10 +339,26 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* ... and the opt-in fragmentation traces */
+static char *frag_tracefiles[] = {
+    FRAG_TRACEFILES, NULL
+};
+
 /* Store names of trace files as array of char *'s */
 static int num_global_tracefiles = 0;
 static char **global_tracefiles = NULL;
 
+/* Upper bounds of the request size classes used to break down latencies */
+static const size_t lat_class_limit[LAT_CLASSES] = {
+    64, 512, 4096, 32768, SIZE_MAX
+};
+static const char *lat_class_name[LAT_CLASSES] = {
+    "<=64", "<=512", "<=4K", "<=32K", ">32K"
+};
+static const char *lat_op_name[LAT_OPTYPES] = {
+    "malloc", "free", "realloc"
+};
+
 /* Summary statistics for libc and student's mm.c submissions */
 static sum_stats_t global_libc_sum_stats;
 static sum_stats_t global_mm_sum_stats;
@@ -217,11 +397,39 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_speed_access(void *ptr);
+static void eval_mm_latency(trace_t *trace, const int *source, int num_sources,
+                            stats_t *stats);
+static void eval_mm_windows(trace_t *trace, stats_t *stats);
+static void eval_mm_locality(trace_t *trace, stats_t *stats);
+
+/* Routines for comparing two allocators loaded from shared objects */
+static void load_allocator(allocator_t *alloc, const char *file);
+static bool eval_alloc_valid(allocator_t *alloc, trace_t *trace);
+static void eval_alloc_speed(void *ptr);
+static void run_ab(int num_tracefiles, const char *tracedir, char **tracefiles);
+
+/* Heap aging */
+static void run_aging(int num_tracefiles, const char *tracedir, char **tracefiles);
+
+/* Mixed replay of several traces on one heap */
+static void run_mix(int num_tracefiles, const char *tracedir, char **tracefiles);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printlatency(int n, stats_t *stats);
+static void printwindows(int n, stats_t *stats);
+static void printperf(int n, stats_t *stats);
+static void printrobust(int n, stats_t *stats);
+static void printcold(int n, stats_t *stats);
+static void printaccess(int n, stats_t *stats);
+static void printlocality(int n, stats_t *stats);
+static void printmem(int n, stats_t *stats);
+static void write_json(const char *path, int n, stats_t *stats,
+                       double avg_util, double avg_tput, double ref_tput);
+static int check_baseline(const char *path, int n, stats_t *stats);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -239,8 +447,53 @@ static void timeout_handler(int sig __attribute__((unused))) {
     longjmp(timeout_jmpbuf, 1);
 }
 
-/* Compute throughput from reference implementation */
-static double measure_ref_throughput();
+/* Cache of reference throughput for each processor */
+static bool read_cpu_id(char *cpu_type, char *microcode);
+static double lookup_ref_throughput(const char *cpu_type, const char *microcode);
+static void save_ref_throughput(const char *cpu_type, const char *microcode,
+                                double tput);
+
+/*
+ * heap_footprint - Bytes the allocator holds: its heap and its regions
+ *     from mem_mmap
+ */
+static size_t heap_footprint(void)
+{
+    return mem_heapsize() + mem_mapsize();
+}
+
+/*
+ * minor_faults - Minor page faults taken by the driver so far
+ */
+static double minor_faults(void)
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        unix_error("getrusage failed");
+    return (double) ru.ru_minflt;
+}
+
+/*
+ * time_trace - Measure the seconds f needs to replay a trace, either
+ *    as the K-best minimum or, in robust mode, as the median of all
+ *    samples, recording the spread and confidence interval in stats.
+ */
+static double time_trace(test_funct f, speed_t *params, stats_t *stats)
+{
+    fcyc_stats_t fs;
+
+    if (!robust_mode)
+        return fsec(f, params);
+
+    fsec_stats(f, params, &fs);
+    stats->robust_valid = true;
+    stats->mad = fs.mad;
+    stats->ci_lo = fs.ci_lo;
+    stats->ci_hi = fs.ci_hi;
+    stats->samples = fs.samples;
+    stats->converged = fs.converged;
+    return fs.median;
+}
 
 /*
  * Run the tests; return the number of tests run (may be less than
@@ -269,11 +522,15 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (setjmp(timeout_jmpbuf) != 0) {
             mm_stats[i].valid = false;
         } else {
+            double faults = mem_mode ? minor_faults() : 0;
             if (verbose > 1)
                 printf("Checking mm_malloc for correctness, ");
-            mm_stats[i].valid =
-                /* Do 2 tests, since may fail to reinitialize properly */
-                eval_mm_valid(trace, ranges) && eval_mm_valid(trace, ranges);
+            /* Do 2 tests, since may fail to reinitialize properly */
+            mm_stats[i].valid = eval_mm_valid(trace, ranges);
+            /* The first replay is the one that touches fresh pages */
+            if (mem_mode)
+                mm_stats[i].faults_first = minor_faults() - faults;
+            mm_stats[i].valid = mm_stats[i].valid && eval_mm_valid(trace, ranges);
 
             if (onetime_flag) {
                 free_trace(trace);
@@ -283,12 +540,78 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i]);
+            if (locality_mode)
+                eval_mm_locality(trace, &mm_stats[i]);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
+            speed_params->runs = 0;
             if (verbose > 1)
                 printf("and performance.\n");
-            mm_stats[i].secs = fsec(eval_mm_speed, speed_params);
+            if (perf_mode)
+                perf_start(&perf_counters);
+            if (mem_mode)
+                mm_stats[i].faults_timed = minor_faults();
+            mm_stats[i].secs = time_trace(eval_mm_speed, speed_params,
+                                          &mm_stats[i]);
+            if (mem_mode) {
+                mm_stats[i].faults_timed =
+                    (minor_faults() - mm_stats[i].faults_timed) / speed_params->runs;
+                mm_stats[i].resident = mem_resident();
+                mm_stats[i].mem_valid = true;
+            }
+            if (perf_mode) {
+                int c;
+                double ops = (double) trace->num_ops * speed_params->runs;
+                perf_stop(&perf_counters);
+                for (c = 0; c < PC_NUM; c++) {
+                    double count = perf_counters.count[c];
+                    mm_stats[i].perf[c] = count < 0 ? -1.0 : count / ops;
+                }
+                mm_stats[i].perf_valid = true;
+            }
+            if (access_reads > 0) {
+                if (verbose > 1)
+                    printf("Timing with payload accesses.\n");
+                speed_params->live = (int *) malloc(trace->num_ids * sizeof(int));
+                speed_params->live_pos = (int *) malloc(trace->num_ids * sizeof(int));
+                if (!speed_params->live || !speed_params->live_pos)
+                    unix_error("malloc failed in run_tests");
+                mm_stats[i].secs_access = fsec(eval_mm_speed_access, speed_params);
+                mm_stats[i].access_valid = true;
+                free(speed_params->live);
+                free(speed_params->live_pos);
+            }
+            if (cold_mode) {
+                if (verbose > 1)
+                    printf("Timing with cold caches.\n");
+                mm_stats[i].secs_cold = fsec_r(cold_ctx, eval_mm_speed,
+                                               speed_params);
+                mm_stats[i].cold_valid = true;
+            }
+            if (latency_mode) {
+                if (verbose > 1)
+                    printf("Measuring per-call latency.\n");
+                eval_mm_latency(trace, NULL, 1, &mm_stats[i]);
+            }
+            if (win_ops > 0) {
+                if (verbose > 1)
+                    printf("Timing windows of %ld requests.\n", win_ops);
+                eval_mm_windows(trace, &mm_stats[i]);
+            }
+        }
+
+        /* Calibrate on the same trace, under the same conditions as mm */
+        if (ref_calibrate &&
+            (mm_stats[i].weight == WALL || mm_stats[i].weight == WPERF)) {
+            stats_t ref_stats;
+            if (verbose > 1)
+                printf("Timing the reference allocator.\n");
+            speed_params->trace = trace;
+            speed_params->alloc = &ref_alloc;
+            speed_params->runs = 0;
+            ref_secs += time_trace(eval_alloc_speed, speed_params, &ref_stats);
+            ref_ops += trace->num_ops;
         }
 
 #if 0
@@ -306,7 +629,10 @@ static void run_tests(int num_tracefiles, const char *tracedir,
 
 double score_component(double perf, double min_perf, double max_perf)
 {
-    if (perf < min_perf) {
+    /* No range to score against, e.g. no throughput traces were timed */
+    if (max_perf <= min_perf) {
+        return 0.0;
+    } else if (perf < min_perf) {
         return 0.0;
     } else if (perf > max_perf) {
         return 1.0;
@@ -347,16 +673,18 @@ int main(int argc, char **argv)
     double min_throughput = 5000;
     double max_throughput = 10000;;
 
-
-#if !REF_ONLY
-
-    double ref_throughput;
+    double ref_throughput = 0.0;
+    bool ref_recalibrate = false;  /* Ignore any cached throughput (set by -K) */
+    bool default_traces;
+    bool frag_traces = false;      /* Add the fragmentation traces (set by -F) */
+    bool have_cpu_id;
+    char cpu_type[MAXLINE], microcode[MAXLINE];
 
     char c;
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hOVlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hOVlDTLPR:CA:B:N:Kj:b:e:Fu:w:W:a:m:x:grHGp:")) != EOF) {
         switch (c) {
 
             case 'f': /* Use one specific trace file only (relative to curr dir) */
@@ -406,6 +734,138 @@ int main(int argc, char **argv)
                 tab_mode = true;
                 break;
 
+            case 'L':
+                latency_mode = true;
+                break;
+
+            case 'W': /* Time windows of optarg requests */
+                win_ops = atol(optarg);
+                if (win_ops < 1)
+                    app_error("Window must be at least 1 request\n");
+                break;
+
+            case 'P':
+                perf_mode = true;
+                break;
+
+            case 'R': /* Robust timing, to a confidence interval of optarg percent */
+                robust_mode = true;
+                set_fcyc_ci_width(atof(optarg) / 100.0);
+                set_fcyc_maxsamples(ROBUST_MAXSAMPLES);
+                break;
+
+            case 'C': /* Time with cold caches as well */
+                cold_mode = true;
+                break;
+
+            case 'r': /* Measure resident memory and page faults */
+                mem_mode = true;
+                break;
+
+            case 'H': /* Advise transparent huge pages on the heap */
+                heap_hugepage = true;
+                mem_mode = true;
+                break;
+
+            case 'G': /* Align the heap to a 2MB huge page */
+                heap_align = true;
+                mem_mode = true;
+                break;
+
+            case 'p': { /* Pre-fault the first optarg bytes of the heap */
+                char *unit;
+                double bytes = strtod(optarg, &unit);
+                if (*unit == 'k' || *unit == 'K')
+                    bytes *= 1 << 10;
+                else if (*unit == 'm' || *unit == 'M')
+                    bytes *= 1 << 20;
+                else if (*unit == 'g' || *unit == 'G')
+                    bytes *= 1 << 30;
+                if (bytes < 1)
+                    app_error("Need a positive number of bytes to populate\n");
+                heap_populate = (size_t) bytes;
+                mem_mode = true;
+                break;
+            }
+
+            case 'g': /* Measure how many pages and lines the live set spans */
+                locality_mode = true;
+                break;
+
+            case 'x': /* Time with optarg payload reads per request as well */
+                access_reads = atof(optarg);
+                if (access_reads <= 0)
+                    app_error("Need a positive number of reads per request\n");
+                break;
+
+            case 'A': /* Compare two allocators in shared objects */
+                ab_files[0] = optarg;
+                break;
+
+            case 'B':
+                ab_files[1] = optarg;
+                break;
+
+            case 'N': /* Number of rounds for the A/B comparison */
+                ab_rounds = atoi(optarg);
+                if (ab_rounds < 2)
+                    app_error("Need at least 2 rounds for an A/B comparison\n");
+                break;
+
+            case 'a': /* Replay the traces optarg times on one heap */
+                age_passes = atoi(optarg);
+                if (age_passes < 1)
+                    app_error("Need at least 1 pass for heap aging\n");
+                break;
+
+            case 'm': /* Interleave the traces on one heap */
+                mix_mode = optarg;
+                if (strcmp(mix_mode, "rr") != 0 && strcmp(mix_mode, "random") != 0 &&
+                    strcmp(mix_mode, "weighted") != 0)
+                    app_error("Unknown mix mode '%s'; use rr, random or weighted\n",
+                              mix_mode);
+                break;
+
+            case 'K': /* Recalibrate the reference throughput */
+                ref_recalibrate = true;
+                break;
+
+            case 'F': /* Run the fragmentation traces too */
+                frag_traces = true;
+                break;
+
+            case 'u': /* Write a utilization timeline */
+                if ((util_csv = fopen(optarg, "w")) == NULL)
+                    unix_error("Could not open %s", optarg);
+                fprintf(util_csv, "trace,op,live_bytes,heap_bytes,util,free_bytes,"
+                        "largest_free,free_blocks,alloc_blocks,frag_index\n");
+                break;
+
+            case 'w': /* Requests per row of the utilization timeline */
+                util_window = atol(optarg);
+                if (util_window < 1)
+                    app_error("Window must be at least 1 request\n");
+                break;
+
+            case 'j': /* Write results as JSON */
+                json_file = optarg;
+                /* Keep stdout for the JSON alone, and send the rest to stderr */
+                if (strcmp(optarg, "-") == 0 && json_stdout == NULL) {
+                    int fd = dup(STDOUT_FILENO);
+                    if (fd < 0 || (json_stdout = fdopen(fd, "w")) == NULL ||
+                        dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+                        unix_error("Could not redirect output for -j -");
+                }
+                break;
+
+            case 'b': /* Check for regressions against a baseline */
+                baseline_file = optarg;
+                break;
+
+            case 'e': /* Default throughput tolerance, in percent */
+                kops_tolerance = atof(optarg) / 100.0;
+                break;
+
             case 'h': /* Print this message */
                 usage(argv[0]);
                 exit(0);
@@ -415,24 +875,84 @@ int main(int argc, char **argv)
                 exit(1);
         }
     }
-#endif /* !REF_ONLY */
 
+    /* How mem_init maps each heap */
+    mem_options(heap_hugepage, heap_align, heap_populate);
+
+    /* Only the default traces define the reference throughput */
+    default_traces = num_global_tracefiles == 0;
     if (num_global_tracefiles == 0) {
         int i;
         for (i = 0; default_tracefiles[i]; i++)
             add_tracefile(default_tracefiles[i]);
+        if (frag_traces) {
+            for (i = 0; frag_tracefiles[i]; i++)
+                add_tracefile(frag_tracefiles[i]);
+        }
+    } else if (frag_traces) {
+        app_error("-F adds to the default traces, and can't be used with -f or -c\n");
     }
 
     if (debug_mode != DBG_NONE) {
         init_random_data();
     }
 
+    /* Cycles per op are reported at the (calibrated) counter rate */
+    cycle_mhz = mhz(verbose > 1);
+
+    /*
+     * Cold-cache timing flushes the caches before every sample, each
+     * of which is a single replay where the timer allows
+     */
+    if (cold_mode) {
+        long flush_bytes = 1 << 19;
+        long line_bytes = 32;
+        if (!fcyc_detect_cache(&flush_bytes, &line_bytes) && verbose)
+            fprintf(stderr, "Warning: Could not find cache sizes in sysfs. "
+                    "Flushing %ld bytes\n", flush_bytes);
+        cold_ctx = fcyc_ctx_new();
+        set_fcyc_clear_cache_r(cold_ctx, 1);
+        set_fcyc_cache_size_r(cold_ctx, FLUSH_FACTOR * flush_bytes);
+        set_fcyc_cache_block_r(cold_ctx, line_bytes);
+        set_fcyc_min_reps_r(cold_ctx, 1);
+        if (verbose > 1)
+            printf("Cold-cache flush: %ld bytes in %ld-byte lines\n",
+                   FLUSH_FACTOR * flush_bytes, line_bytes);
+    }
+
+    /* Carry on without counters if perf access is restricted */
+    if (perf_mode && perf_open(&perf_counters, verbose) == 0) {
+        if (verbose)
+            fprintf(stderr, "Warning: Continuing without performance counters\n");
+        perf_mode = false;
+    }
+
     /* Initialize the timeout */
     if (set_timeout > 0) {
         signal(SIGALRM, timeout_handler);
         alarm(set_timeout); 
     }
 
+    /* An A/B comparison replaces the usual evaluation */
+    if (ab_files[0] || ab_files[1]) {
+        if (!ab_files[0] || !ab_files[1])
+            app_error("A/B comparison needs both -A and -B\n");
+        run_ab(num_global_tracefiles, tracedir, global_tracefiles);
+        exit(0);
+    }
+
+    /* So does heap aging */
+    if (age_passes > 0) {
+        run_aging(num_global_tracefiles, tracedir, global_tracefiles);
+        exit(0);
+    }
+
+    /* ... and a mixed replay */
+    if (mix_mode) {
+        run_mix(num_global_tracefiles, tracedir, global_tracefiles);
+        exit(0);
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package
      */
@@ -456,7 +976,8 @@ int main(int argc, char **argv)
                 speed_params.trace = trace;
                 if (verbose > 1)
                     printf("and performance.\n");
-                libc_stats[i].secs = fsec(eval_libc_speed, &speed_params);
+                libc_stats[i].secs = time_trace(eval_libc_speed, &speed_params,
+                                                &libc_stats[i]);
             }
             free_trace(trace);
         }
@@ -469,21 +990,16 @@ int main(int argc, char **argv)
         }
     }
 
-#if !REF_ONLY
     /*
-     * Get benchmark throughput
+     * Get benchmark throughput from the cache.  If this processor has
+     * no entry, time the reference allocator along with mm
      */
-    ref_throughput = measure_ref_throughput();
-
-    min_throughput_checkpoint = ref_throughput * MIN_SPEED_RATIO_CHECKPOINT;
-
-    max_throughput_checkpoint = ref_throughput * MAX_SPEED_RATIO_CHECKPOINT;
-
-    min_throughput = ref_throughput * MIN_SPEED_RATIO;
-
-    max_throughput = ref_throughput * MAX_SPEED_RATIO;
-
-#endif
+    have_cpu_id = read_cpu_id(cpu_type, microcode);
+    if (have_cpu_id && !ref_recalibrate)
+        ref_throughput = lookup_ref_throughput(cpu_type, microcode);
+    ref_calibrate = ref_throughput == 0.0 && !onetime_flag;
+    if (ref_calibrate && verbose > 0)
+        printf("Calibrating reference throughput along with each trace\n");
 
     /*
      * Always run and evaluate the student's mm package
@@ -499,6 +1015,22 @@ int main(int argc, char **argv)
     run_tests(num_global_tracefiles, tracedir, global_tracefiles, mm_stats,
               &speed_params);
 
+    if (ref_calibrate && ref_secs > 0) {
+        ref_throughput = ref_ops / ref_secs * 0.001;
+        if (default_traces && have_cpu_id)
+            save_ref_throughput(cpu_type, microcode, ref_throughput);
+        else if (verbose > 0)
+            printf("Reference throughput %.0f Kops/sec is for these traces "
+                   "only, and was not saved\n", ref_throughput);
+    }
+
+    min_throughput_checkpoint = ref_throughput * MIN_SPEED_RATIO_CHECKPOINT;
+
+    max_throughput_checkpoint = ref_throughput * MAX_SPEED_RATIO_CHECKPOINT;
+
+    min_throughput = ref_throughput * MIN_SPEED_RATIO;
+
+    max_throughput = ref_throughput * MAX_SPEED_RATIO;
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -583,13 +1115,11 @@ int main(int argc, char **argv)
 
         perfindex = (p1 * UTIL_WEIGHT + p2 * (1.0 - UTIL_WEIGHT)) * 100.0;
 
-#if !REF_ONLY
         if (!tab_mode) {
             printf("Average utilization = %.1f%%. Average throughput = %.0f Kops/sec\n",
                    avg_mm_util * 100.0,
                    avg_mm_throughput);
         }
-#endif
     }
     else { /* There were errors */
         p1_checkpoint = 0.0;
@@ -603,9 +1133,6 @@ int main(int argc, char **argv)
         printf("Terminated with %d errors\n", errors);
     }
 
-#if REF_ONLY
-    printf("%.0f\n", avg_mm_throughput);
-#else /* !REF_ONLY */
     if (verbose > 0) {
         printf("\n");
         printf("***Checkpoint 1 correctness index = %.1f/50.0***\n",
@@ -620,8 +1147,11 @@ int main(int argc, char **argv)
                avg_mm_throughput);
         printf("Utilization targets: min=%.1f%%, max=%.1f%%\n",
                MIN_SPACE_CHECKPOINT * 100.0, MAX_SPACE_CHECKPOINT * 100.0);
-        printf("Throughput targets: min=%.0f, max=%.0f, benchmark=%.0f\n",
-               min_throughput_checkpoint, max_throughput_checkpoint, ref_throughput);
+        if (max_throughput_checkpoint <= min_throughput_checkpoint)
+            printf("Throughput targets: no throughput traces\n");
+        else
+            printf("Throughput targets: min=%.0f, max=%.0f, benchmark=%.0f\n",
+                   min_throughput_checkpoint, max_throughput_checkpoint, ref_throughput);
         printf("\n");
         printf("***Final perf index = %.1f (util) + %.1f (thru) = %.1f/100.0***\n",
                p1*UTIL_WEIGHT*100,
@@ -632,15 +1162,26 @@ int main(int argc, char **argv)
                avg_mm_throughput);
         printf("Utilization targets: min=%.1f%%, max=%.1f%%\n",
                MIN_SPACE * 100.0, MAX_SPACE * 100.0);
-        printf("Throughput targets: min=%.0f, max=%.0f, benchmark=%.0f\n",
-               min_throughput, max_throughput, ref_throughput);
+        if (max_throughput <= min_throughput)
+            printf("Throughput targets: no throughput traces\n");
+        else
+            printf("Throughput targets: min=%.0f, max=%.0f, benchmark=%.0f\n",
+                   min_throughput, max_throughput, ref_throughput);
         printf("\n");
     }
     printf("Score: Checkpoint 1: %d / 50, Checkpoint 2: %d / 100, Final: %d / 100\n",
            (int)ceil(correctindex),
            (int)ceil(perfindex_checkpoint),
            (int)ceil(perfindex));
-#endif
+
+    if (json_file)
+        write_json(json_file, num_global_tracefiles, mm_stats,
+                   avg_mm_util, avg_mm_throughput, ref_throughput);
+
+    /* A regression fails the run, for use as a CI gate */
+    if (baseline_file &&
+        check_baseline(baseline_file, num_global_tracefiles, mm_stats) > 0)
+        exit(1);
 
     exit(0);
 }
@@ -692,9 +1233,11 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or of one
+       region from mem_mmap */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_is_mapped(lo, hi)) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -1160,19 +1703,46 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     return true;
 }
 
+/*
+ * write_util_row - Record the state of the heap after opnum requests:
+ *     live payload, heap size, and how the free space is split up.
+ *     The external fragmentation index is 1 - largest free block /
+ *     free bytes: 0 when the free space is one block, and close to 1
+ *     when it is in many small pieces.
+ */
+static void write_util_row(const trace_t *trace, int opnum,
+                           size_t live_bytes, size_t heap_bytes)
+{
+    mm_heapstats_t hs;
+    double frag;
+
+    mm_heapstats(&hs);
+    frag = hs.free_bytes == 0 ? 0.0 :
+        1.0 - (double) hs.largest_free / (double) hs.free_bytes;
+    fprintf(util_csv, "%s,%d,%zu,%zu,%.4f,%zu,%zu,%zu,%zu,%.4f\n",
+            trace->filename, opnum, live_bytes, heap_bytes,
+            heap_bytes == 0 ? 0.0 : (double) live_bytes / heap_bytes,
+            hs.free_bytes, hs.largest_free, hs.free_blocks, hs.alloc_blocks,
+            frag);
+}
+
 /*
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
  *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   package on the trace.  The heap counts the regions from mem_mmap
+ *   as well.  Since mem_sbrk() lets the heap shrink, the
+ *   heap size used is its high water mark over the trace.  That and
+ *   the size of the heap at the end of the trace go in stats.
+ *
+ *   With -r, it also samples the heap bytes on huge pages as the
+ *   heap grows, since by the end of the trace mm may have freed them.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
     int i;
     int index;
@@ -1181,6 +1751,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     size_t total_size = 0;
     size_t max_heap_size = 0;
     size_t heap_size = 0;
+    size_t huge_at = HUGE_SAMPLE_MIN; /* heap size of the next huge page sample */
     char *p;
     char *newp, *oldp;
 
@@ -1251,19 +1822,164 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
-        heap_size = mem_heapsize();
+        heap_size = heap_footprint();
         max_heap_size = (heap_size > max_heap_size) ?
             heap_size : max_heap_size;
+
+        /* Sample huge pages as the heap doubles, since reading smaps is slow */
+        if (mem_mode && heap_size >= huge_at) {
+            double huge = mem_hugepages();
+            stats->huge = huge > stats->huge ? huge : stats->huge;
+            huge_at = 2 * heap_size;
+        }
+
+        /* Record a row of the timeline at the end of each window */
+        if (util_csv && ((i + 1) % util_window == 0 || i + 1 == trace->num_ops))
+            write_util_row(trace, i + 1, total_size, heap_size);
     }
 
-#if !REF_ONLY
     printf(".");
-#endif
 
+    stats->heap_peak = max_heap_size;
+    stats->heap_final = heap_size;
     return ((double)max_total_size / (double)max_heap_size);
 }
 
 
+/* A payload extent [lo, hi), for the locality metrics */
+typedef struct {
+    uintptr_t lo;
+    uintptr_t hi;
+} extent_t;
+
+static int cmp_extent(const void *a, const void *b)
+{
+    uintptr_t la = ((const extent_t *) a)->lo, lb = ((const extent_t *) b)->lo;
+    return la < lb ? -1 : la > lb;
+}
+
+/*
+ * span_units - Count the distinct units of 1 << shift bytes touched by
+ *     n payload extents [lo, hi).  Sorts the extents in place.
+ */
+static size_t span_units(extent_t *ext, long n, int shift)
+{
+    size_t units = 0;
+    uintptr_t covered = 0;    /* one past the last unit counted */
+    long i;
+
+    qsort(ext, n, sizeof(extent_t), cmp_extent);
+    for (i = 0; i < n; i++) {
+        uintptr_t first = ext[i].lo >> shift;
+        uintptr_t end = ((ext[i].hi - 1) >> shift) + 1;
+        if (first < covered)
+            first = covered;
+        if (end > first) {
+            units += end - first;
+            covered = end;
+        }
+    }
+    return units;
+}
+
+/*
+ * eval_mm_locality - Replay the trace, and at LOC_SAMPLES points count
+ *     the LOC_PAGE pages and LOC_LINE lines that the live payloads
+ *     touch.  Each count is divided by the fewest units that could hold
+ *     the live bytes, giving the spread: 1 for a perfectly packed live
+ *     set, and larger as blocks are scattered among free space, headers
+ *     and padding.  Utilization says how big the heap is; spread says
+ *     how much of it a program walking its data actually touches.
+ */
+static void eval_mm_locality(trace_t *trace, stats_t *stats)
+{
+    int i, index, samples = 0;
+    long every = trace->num_ops / LOC_SAMPLES, n, id;
+    size_t size, live = 0;
+    double pages, lines;
+    char *p;
+    extent_t *ext;
+
+    if (every < 1)
+        every = 1;
+    if ((ext = (extent_t *) malloc(trace->num_ids * sizeof(extent_t))) == NULL)
+        unix_error("malloc failed in eval_mm_locality");
+    stats->page_spread_avg = stats->page_spread_max = 0;
+    stats->line_spread_avg = stats->line_spread_max = 0;
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_locality");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* mm_malloc */
+                if ((p = mm_malloc(size)) == NULL)
+                    app_error("mm_malloc error in eval_mm_locality");
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                live += size;
+                break;
+
+            case REALLOC: /* mm_realloc */
+                if ((p = mm_realloc(trace->blocks[index], size)) == NULL && size != 0)
+                    app_error("mm_realloc error in eval_mm_locality");
+                live += size - trace->block_sizes[index];
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                break;
+
+            case FREE: /* mm_free */
+                if (index < 0) {
+                    mm_free(NULL);
+                    break;
+                }
+                mm_free(trace->blocks[index]);
+                live -= trace->block_sizes[index];
+                trace->blocks[index] = NULL;
+                trace->block_sizes[index] = 0;
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_mm_locality");
+        }
+
+        if ((i + 1) % every != 0 || live == 0)
+            continue;
+
+        /* Snapshot the live set */
+        for (n = 0, id = 0; id < trace->num_ids; id++) {
+            if (trace->blocks[id] == NULL || trace->block_sizes[id] == 0)
+                continue;
+            ext[n].lo = (uintptr_t) trace->blocks[id];
+            ext[n].hi = ext[n].lo + trace->block_sizes[id];
+            n++;
+        }
+        pages = (double) span_units(ext, n, __builtin_ctz(LOC_PAGE)) /
+            ((live + LOC_PAGE - 1) / LOC_PAGE);
+        lines = (double) span_units(ext, n, __builtin_ctz(LOC_LINE)) /
+            ((live + LOC_LINE - 1) / LOC_LINE);
+        stats->page_spread_avg += pages;
+        stats->line_spread_avg += lines;
+        if (pages > stats->page_spread_max)
+            stats->page_spread_max = pages;
+        if (lines > stats->line_spread_max)
+            stats->line_spread_max = lines;
+        samples++;
+    }
+
+    if (samples > 0) {
+        stats->page_spread_avg /= samples;
+        stats->line_spread_avg /= samples;
+        stats->loc_valid = true;
+    }
+    free(ext);
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
@@ -1274,6 +1990,7 @@ static void eval_mm_speed(void *ptr)
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    ((speed_t *)ptr)->runs++;
     reinit_trace(trace);
 
     /* Reset the heap and initialize the mm package */
@@ -1318,31 +2035,354 @@ static void eval_mm_speed(void *ptr)
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * access_rand - Random numbers for eval_mm_speed_access.  An xorshift
+ *    generator, cheap enough not to distort the timing
  */
-static bool eval_libc_valid(trace_t *trace)
+static uint64_t access_state;
+
+static inline uint64_t access_rand(void)
 {
-    int i;
-    size_t newsize;
-    char *p, *newp, *oldp;
+    access_state ^= access_state << 13;
+    access_state ^= access_state >> 7;
+    access_state ^= access_state << 17;
+    return access_state;
+}
+
+/*
+ * access_add, access_remove - Maintain the array of live ids, with
+ *    newer blocks generally toward the end
+ */
+static inline void access_add(speed_t *params, int *num_live, int index)
+{
+    params->live_pos[index] = *num_live;
+    params->live[(*num_live)++] = index;
+}
+
+static inline void access_remove(speed_t *params, int *num_live, int index)
+{
+    int pos = params->live_pos[index];
+    int last = params->live[--(*num_live)];
+    params->live[pos] = last;
+    params->live_pos[last] = pos;
+}
+
+/*
+ * eval_mm_speed_access - Like eval_mm_speed, but acting like a program
+ *    that uses its memory.  Each new payload is written, up to
+ *    ACCESS_WRITE_MAX bytes, and between requests access_reads live
+ *    blocks (on average) are read.  A read goes to one of the
+ *    ACCESS_RECENT newest blocks with probability ACCESS_LOCAL, and
+ *    otherwise to any live block.  An allocator that scatters blocks
+ *    over many lines and pages pays for it here in cache and TLB misses.
+ */
+static volatile uint64_t access_sink;
 
+static void eval_mm_speed_access(void *ptr)
+{
+    int i, index, num_live = 0;
+    size_t size;
+    char *p;
+    double credit = 0;
+    uint64_t sum = 0;
+    speed_t *params = (speed_t *) ptr;
+    trace_t *trace = params->trace;
+    params->runs++;
     reinit_trace(trace);
+    access_state = 0x9E3779B97F4A7C15ull;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_speed_access");
 
     for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
         switch (trace->ops[i].type) {
 
-            case ALLOC: /* malloc */
-                if ((p = malloc(trace->ops[i].size)) == NULL) {
-                    malloc_error(trace, i, "libc malloc failed");
-                    unix_error("System message");
-                }
-                trace->blocks[trace->ops[i].index] = p;
+            case ALLOC: /* mm_malloc */
+                size = trace->ops[i].size;
+                if ((p = mm_malloc(size)) == NULL)
+                    app_error("mm_malloc error in eval_mm_speed_access");
+                trace->blocks[index] = p;
+                memset(p, i, size < ACCESS_WRITE_MAX ? size : ACCESS_WRITE_MAX);
+                access_add(params, &num_live, index);
                 break;
 
-            case REALLOC: /* realloc */
+            case REALLOC: /* mm_realloc */
+                size = trace->ops[i].size;
+                p = mm_realloc(trace->blocks[index], size);
+                if (p == NULL && size != 0)
+                    app_error("mm_realloc error in eval_mm_speed_access");
+                if (trace->blocks[index] != NULL)
+                    access_remove(params, &num_live, index);
+                trace->blocks[index] = p;
+                if (p != NULL) {
+                    memset(p, i, size < ACCESS_WRITE_MAX ? size : ACCESS_WRITE_MAX);
+                    access_add(params, &num_live, index);
+                }
+                break;
+
+            case FREE: /* mm_free */
+                if (index < 0) {
+                    mm_free(NULL);
+                    break;
+                }
+                mm_free(trace->blocks[index]);
+                if (trace->blocks[index] != NULL)
+                    access_remove(params, &num_live, index);
+                trace->blocks[index] = NULL;
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_mm_speed_access");
+        }
+
+        /* Read the first byte of some live blocks */
+        for (credit += access_reads; credit >= 1 && num_live > 0; credit--) {
+            uint64_t r = access_rand();
+            int pos;
+            if ((double) (r >> 11) * (1.0 / 9007199254740992.0) < ACCESS_LOCAL &&
+                num_live > ACCESS_RECENT)
+                pos = num_live - 1 - (int) (access_rand() % ACCESS_RECENT);
+            else
+                pos = (int) (access_rand() % num_live);
+            sum += *(unsigned char *) trace->blocks[params->live[pos]];
+        }
+        /* Reads owed while nothing was live are dropped, not saved up */
+        if (credit >= 1)
+            credit -= (int) credit;
+    }
+    access_sink = sum;
+}
+
+/*
+ * lat_class - Size class of a request, for the latency breakdown
+ */
+static int lat_class(size_t size)
+{
+    int c = 0;
+    while (size > lat_class_limit[c])
+        c++;
+    return c;
+}
+
+/*
+ * summarize_latency - Extract the reported percentiles from a histogram
+ */
+static void summarize_latency(const hist_t *h, lat_summary_t *lat)
+{
+    lat->count = h->count;
+    lat->p50 = hist_percentile(h, 50.0);
+    lat->p99 = hist_percentile(h, 99.0);
+    lat->p999 = hist_percentile(h, 99.9);
+    lat->max = h->max;
+}
+
+/*
+ * eval_mm_latency - Replay the trace, timing every call to the mm
+ *    package individually with the time stamp counter.  The per-call
+ *    times go into histograms by op type and request size class, so
+ *    that rare stalls (e.g., a heap extension) show up in the tail
+ *    percentiles rather than vanishing into the average.  If source is
+ *    not NULL, request i is charged to stats[source[i]], one of
+ *    num_sources; otherwise all go to stats[0].
+ */
+static void eval_mm_latency(trace_t *trace, const int *source, int num_sources,
+                            stats_t *stats)
+{
+    int i, pass, type, index, src;
+    size_t size;
+    char *p, *oldp;
+    uint64_t start, cycles;
+    uint64_t overhead = tsc_overhead();
+    hist_t *hists;
+
+    /* One histogram per source, op type and size class.  Too big for
+       the stack */
+    hists = (hist_t *) malloc(num_sources * LAT_OPTYPES * LAT_CLASSES * sizeof(hist_t));
+    if (hists == NULL)
+        unix_error("malloc failed in eval_mm_latency");
+    for (i = 0; i < num_sources * LAT_OPTYPES * LAT_CLASSES; i++)
+        hist_init(&hists[i]);
+
+    for (pass = 0; pass < LAT_PASSES; pass++) {
+        reinit_trace(trace);
+        mem_reset_brk();
+        if (!mm_init())
+            app_error("mm_init failed in eval_mm_latency");
+
+        for (i = 0;  i < trace->num_ops;  i++) {
+            type = trace->ops[i].type;
+            index = trace->ops[i].index;
+            switch (type) {
+
+                case ALLOC: /* mm_malloc */
+                    size = trace->ops[i].size;
+                    start = read_tsc();
+                    p = mm_malloc(size);
+                    cycles = read_tsc() - start;
+                    if (p == NULL)
+                        app_error("mm_malloc error in eval_mm_latency");
+                    trace->blocks[index] = p;
+                    trace->block_sizes[index] = size;
+                    break;
+
+                case REALLOC: /* mm_realloc */
+                    size = trace->ops[i].size;
+                    oldp = trace->blocks[index];
+                    start = read_tsc();
+                    p = mm_realloc(oldp, size);
+                    cycles = read_tsc() - start;
+                    if (p == NULL && size != 0)
+                        app_error("mm_realloc error in eval_mm_latency");
+                    trace->blocks[index] = p;
+                    trace->block_sizes[index] = size;
+                    break;
+
+                case FREE: /* mm_free */
+                    if (index < 0) {
+                        size = 0;
+                        p = 0;
+                    } else {
+                        size = trace->block_sizes[index];
+                        p = trace->blocks[index];
+                    }
+                    start = read_tsc();
+                    mm_free(p);
+                    cycles = read_tsc() - start;
+                    break;
+
+                default:
+                    app_error("Nonexistent request type in eval_mm_latency");
+            }
+            cycles = cycles > overhead ? cycles - overhead : 0;
+            src = source ? source[i] : 0;
+            hist_record(&hists[(src * LAT_OPTYPES + type) * LAT_CLASSES + lat_class(size)],
+                        cycles);
+        }
+    }
+
+    /* Reduce the histograms to percentiles, overall and by size class */
+    for (src = 0; src < num_sources; src++) {
+        for (type = 0; type < LAT_OPTYPES; type++) {
+            hist_t all;
+            int c;
+            hist_init(&all);
+            for (c = 0; c < LAT_CLASSES; c++) {
+                hist_t *h = &hists[(src * LAT_OPTYPES + type) * LAT_CLASSES + c];
+                summarize_latency(h, &stats[src].lat_class[type][c]);
+                hist_merge(&all, h);
+            }
+            summarize_latency(&all, &stats[src].lat[type]);
+        }
+        stats[src].lat_valid = true;
+    }
+    free(hists);
+}
+
+/*
+ * eval_mm_windows - Replay the trace, reading the time stamp counter
+ *    only at the boundaries of windows of win_ops requests.  Each
+ *    window keeps its fastest time over WIN_PASSES replays, so that
+ *    interrupts don't show up as slow regions.  The result is the cost
+ *    per op of each window, which locates where in a long trace the
+ *    time goes.
+ */
+static void eval_mm_windows(trace_t *trace, stats_t *stats)
+{
+    int i, pass, index;
+    long w, nwin = (trace->num_ops + win_ops - 1) / win_ops;
+    char *p;
+    uint64_t start, now;
+    uint64_t *best;
+
+    if (nwin == 0)
+        return;
+    best = (uint64_t *) malloc(nwin * sizeof(uint64_t));
+    stats->win_cycles = (double *) malloc(nwin * sizeof(double));
+    if (best == NULL || stats->win_cycles == NULL)
+        unix_error("malloc failed in eval_mm_windows");
+    for (w = 0; w < nwin; w++)
+        best[w] = UINT64_MAX;
+
+    for (pass = 0; pass < WIN_PASSES; pass++) {
+        reinit_trace(trace);
+        mem_reset_brk();
+        if (!mm_init())
+            app_error("mm_init failed in eval_mm_windows");
+
+        start = read_tsc();
+        for (i = 0;  i < trace->num_ops;  i++) {
+            index = trace->ops[i].index;
+            switch (trace->ops[i].type) {
+
+                case ALLOC: /* mm_malloc */
+                    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+                        app_error("mm_malloc error in eval_mm_windows");
+                    trace->blocks[index] = p;
+                    break;
+
+                case REALLOC: /* mm_realloc */
+                    p = mm_realloc(trace->blocks[index], trace->ops[i].size);
+                    if (p == NULL && trace->ops[i].size != 0)
+                        app_error("mm_realloc error in eval_mm_windows");
+                    trace->blocks[index] = p;
+                    break;
+
+                case FREE: /* mm_free */
+                    mm_free(index < 0 ? NULL : trace->blocks[index]);
+                    break;
+
+                default:
+                    app_error("Nonexistent request type in eval_mm_windows");
+            }
+
+            /* Close the window after its last request */
+            if ((i + 1) % win_ops == 0 || i + 1 == trace->num_ops) {
+                w = i / win_ops;
+                now = read_tsc();
+                if (now - start < best[w])
+                    best[w] = now - start;
+                start = read_tsc();
+            }
+        }
+    }
+
+    for (w = 0; w < nwin; w++) {
+        long ops = w == nwin - 1 ? trace->num_ops - w * win_ops : win_ops;
+        stats->win_cycles[w] = (double) best[w] / ops;
+    }
+    stats->num_windows = nwin;
+    stats->win_valid = true;
+    free(best);
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static bool eval_libc_valid(trace_t *trace)
+{
+    int i;
+    size_t newsize;
+    char *p, *newp, *oldp;
+
+    reinit_trace(trace);
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* malloc */
+                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                    malloc_error(trace, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+                trace->blocks[trace->ops[i].index] = p;
+                break;
+
+            case REALLOC: /* realloc */
                 newsize = trace->ops[i].size;
                 oldp = trace->blocks[trace->ops[i].index];
                 if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0) {
@@ -1360,60 +2400,898 @@ static bool eval_libc_valid(trace_t *trace)
                 }
                 break;
 
-            default:
-                app_error("invalid operation type  in eval_libc_valid");
+            default:
+                app_error("invalid operation type  in eval_libc_valid");
+        }
+    }
+
+    return true;
+}
+
+/*
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package on the set
+ *    of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+    int i;
+    int index;
+    size_t size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    reinit_trace(trace);
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+            case ALLOC: /* malloc */
+                index = trace->ops[i].index;
+                size = trace->ops[i].size;
+                if ((p = malloc(size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+                trace->blocks[index] = p;
+                break;
+
+            case REALLOC: /* realloc */
+                index = trace->ops[i].index;
+                newsize = trace->ops[i].size;
+                oldp = trace->blocks[index];
+                if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0)
+                    unix_error("realloc failed in eval_libc_speed\n");
+
+                trace->blocks[index] = newp;
+                break;
+
+            case FREE: /* free */
+                index = trace->ops[i].index;
+                if (index >= 0) {
+                    block = trace->blocks[index];
+                    free(block);
+                } else {
+                    free(0);
+                }
+                break;
+        }
+    }
+}
+
+/**********************************************************************
+ * The following functions write the results as JSON, and check them
+ * against a baseline written the same way.  Each trace is an object
+ * in "traces", keyed by its file name.  A baseline may add "kops_tol"
+ * or "util_tol" members to any trace to override the default
+ * tolerances, which are fractions of the baseline value.
+ **********************************************************************/
+
+/*
+ * write_lat_json - Write one latency summary as a JSON object
+ */
+static void write_lat_json(FILE *f, const lat_summary_t *lat)
+{
+    fprintf(f, "{\"count\": %.0f, \"p50\": %.0f, \"p99\": %.0f, "
+            "\"p999\": %.0f, \"max\": %.0f}",
+            lat->count, lat->p50, lat->p99, lat->p999, lat->max);
+}
+
+/*
+ * write_json - Write the results for each trace, and the averages that
+ *     go into the score.  Latency, window, memory, spread, counter,
+ *     robust, access and cold-cache data appear for the traces that
+ *     have them.
+ */
+static void write_json(const char *path, int n, stats_t *stats,
+                       double avg_util, double avg_tput, double ref_tput)
+{
+    int i, op, c;
+    FILE *f = strcmp(path, "-") == 0 ? json_stdout : fopen(path, "w");
+
+    if (f == NULL)
+        unix_error("Could not open JSON file %s", path);
+
+    fprintf(f, "{\n  \"benchmark\": ");
+    json_write_string(f, BENCH_KEY);
+    fprintf(f, ",\n  \"ref_kops\": %.0f,\n  \"errors\": %d,\n", ref_tput, errors);
+    fprintf(f, "  \"heap\": {\"hugepage\": %s, \"align_2m\": %s, \"populate\": %zu},\n",
+            heap_hugepage ? "true" : "false", heap_align ? "true" : "false", heap_populate);
+    fprintf(f, "  \"avg_util\": %.6f,\n  \"avg_kops\": %.3f,\n", avg_util, avg_tput);
+    fprintf(f, "  \"traces\": [");
+    for (i = 0; i < n; i++) {
+        stats_t *st = &stats[i];
+        fprintf(f, "%s\n    {\"trace\": ", i > 0 ? "," : "");
+        json_write_string(f, st->filename);
+        fprintf(f, ", \"weight\": %d, \"valid\": %s, \"ops\": %.0f",
+                (int) st->weight, st->valid ? "true" : "false", st->ops);
+        if (st->valid) {
+            fprintf(f, ",\n     \"util\": %.6f, \"secs\": %.9f, \"kops\": %.3f",
+                    st->util, st->secs,
+                    st->secs > 0 ? st->ops / st->secs * 1e-3 : 0.0);
+            fprintf(f, ", \"heap_peak\": %.0f, \"heap_final\": %.0f",
+                    st->heap_peak, st->heap_final);
+            if (cycle_mhz > 0)
+                fprintf(f, ", \"cyc_per_op\": %.2f",
+                        st->secs * cycle_mhz * 1e6 / st->ops);
+        }
+        if (st->valid && st->lat_valid) {
+            fprintf(f, ",\n     \"latency\": {");
+            for (op = 0; op < LAT_OPTYPES; op++) {
+                fprintf(f, "%s\"%s\": ", op > 0 ? ", " : "", lat_op_name[op]);
+                write_lat_json(f, &st->lat[op]);
+            }
+            fprintf(f, "}");
+        }
+        if (st->valid && st->win_valid) {
+            long w;
+            fprintf(f, ",\n     \"windows\": {\"ops\": %ld, \"cyc_per_op\": [", win_ops);
+            for (w = 0; w < st->num_windows; w++)
+                fprintf(f, "%s%.1f", w > 0 ? ", " : "", st->win_cycles[w]);
+            fprintf(f, "]}");
+        }
+        if (st->valid && st->perf_valid) {
+            bool first = true;
+            fprintf(f, ",\n     \"counters_per_op\": {");
+            for (c = 0; c < PC_NUM; c++) {
+                if (st->perf[c] < 0)
+                    continue;
+                fprintf(f, "%s\"%s\": %.4f", first ? "" : ", ",
+                        perf_counter_name[c], st->perf[c]);
+                first = false;
+            }
+            fprintf(f, "}");
+        }
+        if (st->valid && st->robust_valid)
+            fprintf(f, ",\n     \"robust\": {\"mad\": %.9f, \"ci_lo\": %.9f, "
+                    "\"ci_hi\": %.9f, \"samples\": %ld, \"converged\": %s}",
+                    st->mad, st->ci_lo, st->ci_hi, st->samples,
+                    st->converged ? "true" : "false");
+        if (st->valid && st->mem_valid)
+            fprintf(f, ",\n     \"memory\": {\"resident\": %.0f, \"huge\": %.0f, "
+                    "\"faults_first\": %.0f, \"faults_timed\": %.1f}",
+                    st->resident, st->huge, st->faults_first, st->faults_timed);
+        if (st->valid && st->loc_valid)
+            fprintf(f, ",\n     \"spread\": {\"page_avg\": %.4f, \"page_max\": %.4f, "
+                    "\"line_avg\": %.4f, \"line_max\": %.4f}",
+                    st->page_spread_avg, st->page_spread_max,
+                    st->line_spread_avg, st->line_spread_max);
+        if (st->valid && st->access_valid)
+            fprintf(f, ",\n     \"secs_access\": %.9f", st->secs_access);
+        if (st->valid && st->cold_valid)
+            fprintf(f, ",\n     \"secs_cold\": %.9f", st->secs_cold);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+
+    if (fclose(f) != 0)
+        unix_error("Could not write JSON file %s", path);
+}
+
+/*
+ * trace_basename - The file name of a trace, without its directory
+ */
+static const char *trace_basename(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+/*
+ * check_baseline - Compare each trace with the trace of the same file
+ *     name in a baseline JSON file, wherever either was read from.
+ *     Prints every regression, and returns how many there were.  A
+ *     trace missing from the baseline counts as one, and so does
+ *     checking no traces at all, so that a gate never passes by
+ *     default.
+ */
+static int check_baseline(const char *path, int n, stats_t *stats)
+{
+    char err[MAXLINE];
+    json_value_t *base = json_read_file(path, err, MAXLINE);
+    json_value_t *traces = json_get(base, "traces");
+    int i, j, regressions = 0, checked = 0;
+
+    if (base == NULL)
+        app_error("Baseline %s: %s\n", path, err);
+    if (traces == NULL || traces->type != JSON_ARRAY)
+        app_error("Baseline %s has no \"traces\" array\n", path);
+
+    printf("\nChecking against baseline %s\n", path);
+    for (i = 0; i < n; i++) {
+        json_value_t *bt = NULL;
+        double base_kops, base_util, kops_tol, util_tol;
+        double kops = stats[i].secs > 0 ? stats[i].ops / stats[i].secs * 1e-3 : 0.0;
+
+        for (j = 0; j < traces->count; j++) {
+            const char *name = json_string(json_get(traces->items[j], "trace"), "");
+            if (strcmp(trace_basename(name), trace_basename(stats[i].filename)) == 0) {
+                bt = traces->items[j];
+                break;
+            }
+        }
+        if (bt == NULL) {
+            printf("  MISSING %s: not in baseline\n", stats[i].filename);
+            regressions++;
+            continue;
+        }
+        checked++;
+
+        if (!stats[i].valid) {
+            if (json_number(json_get(bt, "valid"), 0)) {
+                printf("  REGRESSION %s: no longer valid\n", stats[i].filename);
+                regressions++;
+            }
+            continue;
+        }
+
+        base_kops = json_number(json_get(bt, "kops"), 0.0);
+        base_util = json_number(json_get(bt, "util"), 0.0);
+        kops_tol = json_number(json_get(bt, "kops_tol"), kops_tolerance);
+        util_tol = json_number(json_get(bt, "util_tol"), UTIL_TOLERANCE);
+
+        /* Only the measures that count for this trace are gated */
+        if ((stats[i].weight == WALL || stats[i].weight == WPERF) &&
+            kops < base_kops * (1.0 - kops_tol)) {
+            printf("  REGRESSION %s: %.0f Kops vs. baseline %.0f (%+.1f%%, tolerance %.1f%%)\n",
+                   stats[i].filename, kops, base_kops,
+                   (kops / base_kops - 1.0) * 100.0, kops_tol * 100.0);
+            regressions++;
+        }
+        if ((stats[i].weight == WALL || stats[i].weight == WUTIL) &&
+            stats[i].util < base_util * (1.0 - util_tol)) {
+            printf("  REGRESSION %s: util %.1f%% vs. baseline %.1f%% (tolerance %.1f%%)\n",
+                   stats[i].filename, stats[i].util * 100.0, base_util * 100.0,
+                   util_tol * 100.0);
+            regressions++;
+        }
+    }
+    printf("%d regression%s in %d traces checked\n",
+           regressions, regressions == 1 ? "" : "s", checked);
+    if (checked == 0) {
+        printf("No traces matched the baseline\n");
+        regressions++;
+    }
+
+    json_free(base);
+    return regressions;
+}
+
+/**********************************************************************
+ * The following functions compare two allocators, each built as a
+ * shared object with its own copy of memlib.  Timing rounds alternate
+ * between them, ABAB..., so that both see the same machine conditions,
+ * and the per-round ratios are tested for significance.
+ **********************************************************************/
+
+/*
+ * load_symbol - Look up a required entry point of a shared object
+ */
+static void *load_symbol(allocator_t *alloc, const char *sym)
+{
+    void *addr = dlsym(alloc->handle, sym);
+    if (addr == NULL)
+        app_error("%s does not define %s\n", alloc->name, sym);
+    return addr;
+}
+
+/*
+ * load_allocator - Load an allocator from a shared object.  Each one
+ *     is opened privately, so that its memlib state is its own.
+ */
+static void load_allocator(allocator_t *alloc, const char *file)
+{
+    /* dlopen only searches the current directory for explicit paths */
+    if (strchr(file, '/') == NULL)
+        snprintf(alloc->name, MAXLINE, "./%s", file);
+    else
+        snprintf(alloc->name, MAXLINE, "%s", file);
+
+    alloc->handle = dlopen(alloc->name, RTLD_NOW | RTLD_LOCAL);
+    if (alloc->handle == NULL)
+        app_error("Could not load %s: %s\n", alloc->name, dlerror());
+
+    alloc->init = (bool (*)(void)) load_symbol(alloc, "mm_init");
+    alloc->malloc = (void *(*)(size_t)) load_symbol(alloc, "mm_malloc");
+    alloc->free = (void (*)(void *)) load_symbol(alloc, "mm_free");
+    alloc->realloc = (void *(*)(void *, size_t)) load_symbol(alloc, "mm_realloc");
+    alloc->mem_init = (void (*)(void)) load_symbol(alloc, "mem_init");
+    alloc->mem_deinit = (void (*)(void)) load_symbol(alloc, "mem_deinit");
+    alloc->mem_reset_brk = (void (*)(void)) load_symbol(alloc, "mem_reset_brk");
+    alloc->mem_heap_lo = (void *(*)(void)) load_symbol(alloc, "mem_heap_lo");
+    alloc->mem_heap_hi = (void *(*)(void)) load_symbol(alloc, "mem_heap_hi");
+    /* Allocators built before mem_mmap existed have no regions to check */
+    alloc->mem_is_mapped = (bool (*)(const void *, const void *))
+        dlsym(alloc->handle, "mem_is_mapped");
+}
+
+/*
+ * eval_alloc_valid - Make sure an allocator can run the trace to
+ *    completion, returning aligned payloads inside its own heap.
+ *    This is a sanity check for a comparison, not a substitute for
+ *    the full checks of eval_mm_valid.
+ */
+static bool eval_alloc_valid(allocator_t *alloc, trace_t *trace)
+{
+    int i, index;
+    size_t size;
+    char *p;
+
+    reinit_trace(trace);
+    alloc->mem_reset_brk();
+    if (!alloc->init()) {
+        malloc_error(trace, 0, "%s: mm_init failed.", alloc->name);
+        return false;
+    }
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* mm_malloc */
+                p = alloc->malloc(size);
+                break;
+
+            case REALLOC: /* mm_realloc */
+                p = alloc->realloc(trace->blocks[index], size);
+                break;
+
+            case FREE: /* mm_free */
+                alloc->free(index < 0 ? NULL : trace->blocks[index]);
+                continue;
+
+            default:
+                app_error("Nonexistent request type in eval_alloc_valid");
+        }
+        /* realloc(p, 0) frees p, so a later free of the id must see NULL */
+        trace->blocks[index] = p;
+        if (size == 0)
+            continue;
+        if (p == NULL) {
+            malloc_error(trace, i, "%s: allocation failed.", alloc->name);
+            return false;
+        }
+        if (!IS_ALIGNED(p) ||
+            ((p < (char *) alloc->mem_heap_lo() ||
+              p + size - 1 > (char *) alloc->mem_heap_hi()) &&
+             (alloc->mem_is_mapped == NULL ||
+              !alloc->mem_is_mapped(p, p + size - 1)))) {
+            malloc_error(trace, i, "%s: payload %p misaligned or outside heap.",
+                         alloc->name, p);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * eval_alloc_speed - Replay the trace on the allocator given in the
+ *    speed parameters.  Timed by fcyc, like eval_mm_speed.
+ */
+static void eval_alloc_speed(void *ptr)
+{
+    int i, index;
+    size_t size;
+    char *p;
+    speed_t *params = (speed_t *) ptr;
+    allocator_t *alloc = params->alloc;
+    trace_t *trace = params->trace;
+    params->runs++;
+    reinit_trace(trace);
+
+    /* Reset the heap and initialize the allocator */
+    alloc->mem_reset_brk();
+    if (!alloc->init())
+        app_error("%s: mm_init failed in eval_alloc_speed", alloc->name);
+
+    /* Interpret each trace request */
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* mm_malloc */
+                if ((p = alloc->malloc(size)) == NULL)
+                    app_error("mm_malloc error in eval_alloc_speed");
+                trace->blocks[index] = p;
+                break;
+
+            case REALLOC: /* mm_realloc */
+                p = alloc->realloc(trace->blocks[index], size);
+                if (p == NULL && size != 0)
+                    app_error("mm_realloc error in eval_alloc_speed");
+                trace->blocks[index] = p;
+                break;
+
+            case FREE: /* mm_free */
+                alloc->free(index < 0 ? NULL : trace->blocks[index]);
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_alloc_speed");
+        }
+    }
+}
+
+/*
+ * sign_flip_pvalue - Two-sided p-value of a paired randomization test
+ *    for whether the differences d[0..n-1] have a nonzero mean.  Under
+ *    the null hypothesis, each difference is equally likely to have
+ *    either sign.  All 2^n sign assignments are tried when that is
+ *    feasible, and AB_FLIPS random ones otherwise.
+ */
+static double sign_flip_pvalue(const double *d, int n)
+{
+    int i;
+    double observed = 0;
+    long trials, extreme = 0, t;
+    bool exact = n <= 16;
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+
+    for (i = 0; i < n; i++)
+        observed += d[i];
+    observed = fabs(observed);
+    trials = exact ? (1L << n) : AB_FLIPS;
+
+    for (t = 0; t < trials; t++) {
+        uint64_t signs;
+        double sum = 0;
+        if (exact) {
+            signs = (uint64_t) t;
+        } else {
+            /* xorshift64 */
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            signs = rng;
+        }
+        for (i = 0; i < n; i++)
+            sum += ((signs >> (i % 64)) & 1) ? -d[i] : d[i];
+        /* Allow for rounding in the identity permutation */
+        if (fabs(sum) >= observed * (1 - 1e-12))
+            extreme++;
+    }
+    return (double) extreme / trials;
+}
+
+/*
+ * run_ab - Compare allocators A and B on every trace.  Reports the
+ *    throughput of each, the speedup of B over A (the geometric mean
+ *    of the per-round time ratios A/B), and the p-value of the
+ *    difference.
+ */
+static void run_ab(int num_tracefiles, const char *tracedir, char **tracefiles)
+{
+    allocator_t alloc[2];
+    speed_t params[2];
+    stats_t stats;
+    fcyc_ctx_t *ctx = fcyc_ctx_new();
+    double *secs[2];
+    double *logratio;
+    double sum_log_speedup = 0;
+    int num_compared = 0;
+    int i, r, k;
+
+    for (k = 0; k < 2; k++) {
+        /* Both heaps are mapped alike, if the allocator's memlib can */
+        void (*options)(bool, bool, size_t);
+        load_allocator(&alloc[k], ab_files[k]);
+        options = (void (*)(bool, bool, size_t)) dlsym(alloc[k].handle, "mem_options");
+        if (options != NULL)
+            options(heap_hugepage, heap_align, heap_populate);
+        alloc[k].mem_init();
+        secs[k] = (double *) calloc(ab_rounds, sizeof(double));
+    }
+    logratio = (double *) calloc(ab_rounds, sizeof(double));
+    if (!secs[0] || !secs[1] || !logratio)
+        unix_error("calloc failed in run_ab");
+
+    printf("A = %s\nB = %s\n", alloc[0].name, alloc[1].name);
+    if (tab_mode) {
+        printf("A Kops\tB Kops\tspeedup\tp\ttrace\n");
+    } else {
+        printf("\n%9s %9s %8s %8s   %s\n",
+               "A Kops", "B Kops", "B/A", "p", "trace");
+    }
+
+    for (i = 0; i < num_tracefiles; i++) {
+        trace_t *trace = read_trace(&stats, tracedir, tracefiles[i]);
+        double med[2], log_speedup = 0, speedup, p;
+
+        if (!eval_alloc_valid(&alloc[0], trace) ||
+            !eval_alloc_valid(&alloc[1], trace)) {
+            printf("%9s %9s %8s %8s   %s (invalid)\n", "-", "-", "-", "-",
+                   trace->filename);
+            free_trace(trace);
+            continue;
+        }
+
+        for (k = 0; k < 2; k++) {
+            params[k].trace = trace;
+            params[k].ranges = NULL;
+            params[k].alloc = &alloc[k];
+        }
+        /* Interleave the timing: A, B, A, B, ... */
+        for (r = 0; r < ab_rounds; r++) {
+            for (k = 0; k < 2; k++)
+                secs[k][r] = fsec_r(ctx, eval_alloc_speed, &params[k]);
+            logratio[r] = log(secs[0][r] / secs[1][r]);
+            log_speedup += logratio[r];
+        }
+        log_speedup /= ab_rounds;
+        speedup = exp(log_speedup);
+        p = sign_flip_pvalue(logratio, ab_rounds);
+
+        for (k = 0; k < 2; k++) {
+            double *sorted = (double *) malloc(ab_rounds * sizeof(double));
+            int j, m;
+            memcpy(sorted, secs[k], ab_rounds * sizeof(double));
+            /* Insertion sort, for the median */
+            for (j = 1; j < ab_rounds; j++)
+                for (m = j; m > 0 && sorted[m-1] > sorted[m]; m--) {
+                    double temp = sorted[m-1];
+                    sorted[m-1] = sorted[m];
+                    sorted[m] = temp;
+                }
+            med[k] = sorted[ab_rounds/2];
+            free(sorted);
+        }
+
+        if (tab_mode) {
+            printf("%.0f\t%.0f\t%.4f\t%.4f\t%s\n",
+                   trace->num_ops * 1e-3 / med[0], trace->num_ops * 1e-3 / med[1],
+                   speedup, p, trace->filename);
+        } else {
+            printf("%9.0f %9.0f %8.3f %8.4f%c  %s\n",
+                   trace->num_ops * 1e-3 / med[0], trace->num_ops * 1e-3 / med[1],
+                   speedup, p, p < AB_ALPHA ? '*' : ' ', trace->filename);
+        }
+        if (trace->weight == WALL || trace->weight == WPERF) {
+            sum_log_speedup += log_speedup;
+            num_compared++;
+        }
+        free_trace(trace);
+    }
+
+    if (!tab_mode) {
+        if (num_compared > 0)
+            printf("\nGeometric mean speedup of B over A on %d throughput traces = %.3f\n",
+                   num_compared, exp(sum_log_speedup / num_compared));
+        printf("B/A > 1 means B is faster.  '*' marks p < %.2f over %d ABAB rounds\n",
+               AB_ALPHA, ab_rounds);
+    }
+
+    for (k = 0; k < 2; k++) {
+        alloc[k].mem_deinit();
+        free(secs[k]);
+    }
+    free(logratio);
+    fcyc_ctx_free(ctx);
+}
+
+/**********************************************************************
+ * The following functions age a heap.  Every other evaluation starts
+ * each replay with mem_reset_brk() and mm_init(), on a pristine heap.
+ * Here the heap is initialized once, and the traces are replayed back
+ * to back on it, pass after pass, so that each replay starts on
+ * whatever the earlier ones left in the free lists.
+ **********************************************************************/
+
+/*
+ * age_replay - Replay a trace on the current heap, then free the blocks
+ *    it left allocated.  Returns the cycles taken by the trace's own
+ *    requests, or a negative value if the heap ran out.  The peak of
+ *    the trace's live payload goes in *peak_live, and the peak of the
+ *    heap footprint in *peak_heap: the heap after the final frees may
+ *    since have been trimmed.
+ */
+static double age_replay(trace_t *trace, size_t *peak_live, size_t *peak_heap)
+{
+    int i, index;
+    size_t size, live = 0;
+    char *p;
+    uint64_t start, cycles;
+
+    reinit_trace(trace);
+    *peak_live = 0;
+    *peak_heap = 0;
+    start = read_tsc();
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* mm_malloc */
+                if ((p = mm_malloc(size)) == NULL)
+                    return -1.0;
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                live += size;
+                break;
+
+            case REALLOC: /* mm_realloc */
+                if ((p = mm_realloc(trace->blocks[index], size)) == NULL && size != 0)
+                    return -1.0;
+                live += size - trace->block_sizes[index];
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                break;
+
+            case FREE: /* mm_free */
+                if (index >= 0) {
+                    mm_free(trace->blocks[index]);
+                    live -= trace->block_sizes[index];
+                    trace->blocks[index] = NULL;
+                    trace->block_sizes[index] = 0;
+                } else {
+                    mm_free(NULL);
+                }
+                break;
+
+            default:
+                app_error("Nonexistent request type in age_replay");
+        }
+        if (live > *peak_live)
+            *peak_live = live;
+        if (heap_footprint() > *peak_heap)
+            *peak_heap = heap_footprint();
+    }
+    cycles = read_tsc() - start;
+
+    /* Leave nothing behind but the state of the free lists */
+    for (index = 0; index < trace->num_ids; index++) {
+        if (trace->blocks[index] != NULL)
+            mm_free(trace->blocks[index]);
+    }
+    return (double) cycles;
+}
+
+/*
+ * run_aging - Replay all the traces, in order, age_passes times on one
+ *    heap.  Reports the throughput of each pass, and the peak heap size
+ *    during it, so that an allocator whose free lists degrade shows up
+ *    as falling Kops or a heap that keeps growing.  One unreported pass
+ *    on a throwaway heap warms the caches and branch predictors first,
+ *    so that pass 1 is not also the cold one.  Each pass is still timed
+ *    once, so its Kops is a single sample.
+ */
+static void run_aging(int num_tracefiles, const char *tracedir, char **tracefiles)
+{
+    trace_t **traces;
+    stats_t stats;
+    range_set_t *ranges;
+    size_t heap = 0, first_heap = 0, peak_live, max_live, peak_heap, max_heap;
+    double cycles, pass_cycles, ops, kops = 0, first_kops = 0;
+    int i, pass;
+
+    traces = (trace_t **) calloc(num_tracefiles, sizeof(trace_t *));
+    if (traces == NULL)
+        unix_error("calloc failed in run_aging");
+
+    /* Check each trace on its own first */
+    mem_init();
+    for (i = 0; i < num_tracefiles; i++) {
+        traces[i] = read_trace(&stats, tracedir, tracefiles[i]);
+        ranges = new_range_set();
+        if (!eval_mm_valid(traces[i], ranges))
+            app_error("mm malloc is not correct on %s; not aging\n",
+                      traces[i]->filename);
+        free_range_set(ranges);
+    }
+
+    /* Warm up on a heap of its own, then start the aged one afresh */
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in run_aging");
+    for (i = 0; i < num_tracefiles; i++)
+        if (age_replay(traces[i], &peak_live, &peak_heap) < 0)
+            break;
+
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in run_aging");
+
+    printf("Aging one heap over %d passes of %d trace%s, after a warm-up pass;"
+           " each pass is timed once\n", age_passes,
+           num_tracefiles, num_tracefiles == 1 ? "" : "s");
+    if (tab_mode)
+        printf("pass\tops\tKops\theap\tpeak_live\ttrace\n");
+    else
+        printf("\n%5s %9s %9s %12s %12s %8s\n",
+               "pass", "ops", "Kops", "heap bytes", "growth", "util");
+
+    for (pass = 1; pass <= age_passes; pass++) {
+        pass_cycles = 0;
+        ops = 0;
+        max_live = 0;
+        max_heap = 0;
+        for (i = 0; i < num_tracefiles; i++) {
+            if ((cycles = age_replay(traces[i], &peak_live, &peak_heap)) < 0) {
+                printf("Out of memory in pass %d on %s, with a %zu byte heap\n",
+                       pass, traces[i]->filename, heap_footprint());
+                goto done;
+            }
+            pass_cycles += cycles;
+            ops += traces[i]->num_ops;
+            if (peak_live > max_live)
+                max_live = peak_live;
+            if (peak_heap > max_heap)
+                max_heap = peak_heap;
+            if (tab_mode)
+                printf("%d\t%d\t%.0f\t%zu\t%zu\t%s\n", pass,
+                       traces[i]->num_ops,
+                       traces[i]->num_ops * cycle_mhz * 1e3 / cycles,
+                       peak_heap, peak_live, traces[i]->filename);
         }
+
+        kops = ops * cycle_mhz * 1e3 / pass_cycles;
+        if (pass == 1) {
+            first_kops = kops;
+            first_heap = max_heap;
+        }
+        if (!tab_mode)
+            printf("%5d %9.0f %9.0f %12zu %+12ld %7.1f%%\n", pass, ops, kops,
+                   max_heap, (long) (max_heap - heap),
+                   100.0 * max_live / max_heap);
+        heap = max_heap;
     }
 
-    return true;
+    if (!tab_mode && age_passes > 1)
+        printf("\nPass %d vs. pass 1: throughput %+.1f%%, heap %+.1f%%\n",
+               age_passes, 100.0 * (kops / first_kops - 1.0),
+               100.0 * ((double) heap / first_heap - 1.0));
+
+done:
+    for (i = 0; i < num_tracefiles; i++)
+        free_trace(traces[i]);
+    free(traces);
+    mem_deinit();
 }
 
+/**********************************************************************
+ * The following functions merge several traces into one request
+ * stream, and evaluate mm on it as a single trace.  This puts the
+ * allocation patterns of different programs side by side on one heap,
+ * where they can fragment each other.
+ **********************************************************************/
+
 /*
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+ * merge_traces - Interleave the requests of n traces into a new trace,
+ *    keeping the order within each.  Each trace's ids are moved up past
+ *    those of the traces before it.  The source trace of each request
+ *    goes in *source.  The mode is one of
+ *
+ *      rr        round robin, one request from each trace in turn
+ *      random    a trace chosen uniformly, among those with requests left
+ *      weighted  a trace chosen with probability proportional to its
+ *                requests left, which spreads every trace evenly over
+ *                the whole stream
  */
-static void eval_libc_speed(void *ptr)
+static trace_t *merge_traces(trace_t **traces, int n, const char *mode,
+                             int **source)
 {
-    int i;
-    int index;
-    size_t size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
-
-    reinit_trace(trace);
+    trace_t *mix;
+    int *next, *base;
+    int i, k, left;
+
+    if ((mix = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
+        unix_error("calloc failed in merge_traces");
+    snprintf(mix->filename, MAXLINE, "mix-%s of %d traces", mode, n);
+    mix->weight = WALL;
+    next = (int *) calloc(n, sizeof(int));
+    base = (int *) calloc(n, sizeof(int));
+    if (next == NULL || base == NULL)
+        unix_error("calloc failed in merge_traces");
+    for (k = 0; k < n; k++) {
+        base[k] = mix->num_ids;
+        mix->num_ids += traces[k]->num_ids;
+        mix->num_ops += traces[k]->num_ops;
+        mix->data_bytes += traces[k]->data_bytes;
+    }
+    mix->ops = (traceop_t *) malloc(mix->num_ops * sizeof(traceop_t));
+    mix->blocks = (char **) calloc(mix->num_ids, sizeof(char *));
+    mix->block_sizes = (size_t *) calloc(mix->num_ids, sizeof(size_t));
+    mix->block_rand_base = calloc(mix->num_ids, sizeof(*mix->block_rand_base));
+    *source = (int *) malloc(mix->num_ops * sizeof(int));
+    if (!mix->ops || !mix->blocks || !mix->block_sizes ||
+        !mix->block_rand_base || !*source)
+        unix_error("malloc failed in merge_traces");
+
+    srandom(MIX_SEED);
+    k = n - 1;
+    for (i = 0, left = mix->num_ops; left > 0; i++, left--) {
+        if (mode[0] == 'r' && mode[1] == 'r') {
+            do
+                k = (k + 1) % n;
+            while (next[k] == traces[k]->num_ops);
+        } else if (mode[0] == 'r') {
+            int live = 0, pick;
+            for (k = 0; k < n; k++)
+                live += next[k] < traces[k]->num_ops;
+            pick = random() % live;
+            for (k = 0; next[k] == traces[k]->num_ops || pick-- > 0; k++)
+                ;
+        } else {
+            long pick = random() % left;
+            for (k = 0; pick >= traces[k]->num_ops - next[k]; k++)
+                pick -= traces[k]->num_ops - next[k];
+        }
+        mix->ops[i] = traces[k]->ops[next[k]++];
+        if (mix->ops[i].index >= 0)
+            mix->ops[i].index += base[k];
+        (*source)[i] = k;
+    }
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-            case ALLOC: /* malloc */
-                index = trace->ops[i].index;
-                size = trace->ops[i].size;
-                if ((p = malloc(size)) == NULL)
-                    unix_error("malloc failed in eval_libc_speed");
-                trace->blocks[index] = p;
-                break;
+    free(next);
+    free(base);
+    return mix;
+}
 
-            case REALLOC: /* realloc */
-                index = trace->ops[i].index;
-                newsize = trace->ops[i].size;
-                oldp = trace->blocks[index];
-                if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0)
-                    unix_error("realloc failed in eval_libc_speed\n");
+/*
+ * run_mix - Evaluate mm on the traces merged by mix_mode.  Reports the
+ *    usual results for the merged trace, each source trace's util when
+ *    run alone for comparison, and with -L per-call latencies by source
+ *    trace.
+ */
+static void run_mix(int num_tracefiles, const char *tracedir, char **tracefiles)
+{
+    trace_t **traces, *mix;
+    stats_t *src_stats, mix_stats;
+    sum_stats_t sum;
+    speed_t params;
+    range_set_t *ranges;
+    int *source;
+    int i;
 
-                trace->blocks[index] = newp;
-                break;
+    traces = (trace_t **) calloc(num_tracefiles, sizeof(trace_t *));
+    src_stats = (stats_t *) calloc(num_tracefiles, sizeof(stats_t));
+    if (traces == NULL || src_stats == NULL)
+        unix_error("calloc failed in run_mix");
+
+    /* Each trace alone, for its util and to check it is correct */
+    mem_init();
+    printf("Sources, alone:\n");
+    for (i = 0; i < num_tracefiles; i++) {
+        traces[i] = read_trace(&src_stats[i], tracedir, tracefiles[i]);
+        ranges = new_range_set();
+        src_stats[i].valid = eval_mm_valid(traces[i], ranges);
+        free_range_set(ranges);
+        if (!src_stats[i].valid)
+            app_error("mm malloc is not correct on %s; not mixing\n",
+                      traces[i]->filename);
+        src_stats[i].util = eval_mm_util(traces[i], i, &src_stats[i]);
+        printf(" %7.1f%%  %s\n", src_stats[i].util * 100.0, traces[i]->filename);
+    }
 
-            case FREE: /* free */
-                index = trace->ops[i].index;
-                if (index >= 0) {
-                    block = trace->blocks[index];
-                    free(block);
-                } else {
-                    free(0);
-                }
-                break;
-        }
+    mix = merge_traces(traces, num_tracefiles, mix_mode, &source);
+    memset(&mix_stats, 0, sizeof(mix_stats));
+    strcpy(mix_stats.filename, mix->filename);
+    mix_stats.weight = mix->weight;
+    mix_stats.ops = mix->num_ops;
+
+    ranges = new_range_set();
+    mix_stats.valid = eval_mm_valid(mix, ranges);
+    if (mix_stats.valid) {
+        mix_stats.util = eval_mm_util(mix, 0, &mix_stats);
+        params.trace = mix;
+        params.ranges = ranges;
+        params.runs = 0;
+        mix_stats.secs = time_trace(eval_mm_speed, &params, &mix_stats);
+        if (latency_mode)
+            eval_mm_latency(mix, source, num_tracefiles, src_stats);
     }
+    free_range_set(ranges);
+
+    printf("\nMixed on one heap:\n");
+    printresults(1, &mix_stats, &sum);
+    if (mix_stats.valid && latency_mode)
+        printlatency(num_tracefiles, src_stats);
+
+    for (i = 0; i < num_tracefiles; i++)
+        free_trace(traces[i]);
+    free_trace(mix);
+    free(source);
+    free(traces);
+    free(src_stats);
+    mem_deinit();
 }
 
 /*************************************
@@ -1441,10 +3319,10 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
 
     /* Print the individual results for each trace */
     if (tab_mode) {
-        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace\n");
+        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\tCyc/op\ttrace\n");
     } else {
-        printf("  %5s  %6s %7s%8s%8s  %s\n",
-               "valid", "util", "ops", "msecs", "Kops", "trace");
+        printf("  %5s  %6s %7s%8s%8s%8s  %s\n",
+               "valid", "util", "ops", "msecs", "Kops", "Cyc/op", "trace");
     }
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
@@ -1495,16 +3373,17 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
             /* Ops + Time */
             double msecs = stats[i].secs * 1000.0;
             double kops = (stats[i].ops*1e-3)/stats[i].secs;
+            double cpo = stats[i].secs * cycle_mhz * 1e6 / stats[i].ops;
             if (tab_mode) {
-                printf("%.0f\t%.3f\t%.0f\t",
-                       stats[i].ops, msecs, kops);
+                printf("%.0f\t%.3f\t%.0f\t%.1f\t",
+                       stats[i].ops, msecs, kops, cpo);
             } else {
                 /* print '--' if perf isn't weighted */
                 if (stats[i].weight == WNONE || stats[i].weight == WALL
                     || stats[i].weight == WPERF)
-                    printf("%8.0f%10.3f%7.0f ", stats[i].ops, msecs, kops);
+                    printf("%8.0f%10.3f%7.0f%8.1f ", stats[i].ops, msecs, kops, cpo);
                 else
-                    printf("%8s%10s%7s ", "--", "--", "--");
+                    printf("%8s%10s%7s%8s ", "--", "--", "--", "--");
             }
 
             printf("%s\n", stats[i].filename);
@@ -1523,15 +3402,16 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         }
         else {
             if (tab_mode) {
-                printf("no\t\t\t\t\t\t\t%s\n", stats[i].filename);
+                printf("no\t\t\t\t\t\t\t\t%s\n", stats[i].filename);
             } else {
-                printf("%2s%4s%7s%10s%7s%10s %s\n",
+                printf("%2s%4s%7s%10s%7s%10s%8s %s\n",
                        stats[i].weight != 0 ? "*" : "",
                        "no",
                        "-",
                        "-",
                        "-",
                        "-",
+                       "-",
                        stats[i].filename);
             }
         }
@@ -1546,20 +3426,22 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
 
         double util = (sumutil/(double)sum_util_weight)*100.0;
         double tput = (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs;
+        double cpo = (sumops==0.0) ? 0 : sumsecs * cycle_mhz * 1e6 / sumops;
         if (tab_mode) {
-            // "valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace"
+            // "valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\tCyc/op\ttrace"
             printf("Sum\t%d\t%d\t%.1f\t%.0f\t\%.2f\n",
                    sum_perf_weight, sum_util_weight, sumutil*100.0, sumops, sumsecs * 1000.0);
-            printf("Avg\t\t\t%.1f\t\t\t%.0f\n",
-                   util, tput);
+            printf("Avg\t\t\t%.1f\t\t\t%.0f\t%.1f\n",
+                   util, tput, cpo);
         } else {
-            printf("%2d %2d  %7.1f%%%8.0f%10.3f%7.0f\n",
+            printf("%2d %2d  %7.1f%%%8.0f%10.3f%7.0f%8.1f\n",
                    sum_util_weight,
                    sum_perf_weight,
                    util,
                    sumops,
                    sumsecs * 1000.0,
-                   tput);
+                   tput,
+                   cpo);
         }
 
         /* Record the summary statistics so we can compare libc and
@@ -1568,10 +3450,12 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         sumstats->ops = sumops;
         sumstats->secs = sumsecs;
         sumstats->tput = tput;
+        sumstats->cpo = cpo;
     }
     else {
         if (!tab_mode) {
-            printf("     %8s%10s%7s\n",
+            printf("     %8s%10s%7s%8s\n",
+                   "-",
                    "-",
                    "-",
                    "-");
@@ -1583,6 +3467,425 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         sumstats->ops = 0;
         sumstats->secs = 0;
         sumstats->tput = 0;
+        sumstats->cpo = 0;
+    }
+
+    /* Tail latencies, if the latency pass was run */
+    for (i = 0; i < n; i++) {
+        if (stats[i].valid && stats[i].lat_valid) {
+            printlatency(n, stats);
+            break;
+        }
+    }
+
+    /* Slowest windows, if the windowed pass was run */
+    for (i = 0; i < n; i++) {
+        if (stats[i].valid && stats[i].win_valid) {
+            printwindows(n, stats);
+            break;
+        }
+    }
+
+    /* Performance counters, if they were read */
+    for (i = 0; i < n; i++) {
+        if (stats[i].valid && stats[i].perf_valid) {
+            printperf(n, stats);
+            break;
+        }
+    }
+
+    /* Spread of the timing samples, in robust mode */
+    for (i = 0; i < n; i++) {
+        if (stats[i].valid && stats[i].robust_valid) {
+            printrobust(n, stats);
+            break;
+        }
+    }
+
+    /* Resident memory and page faults */
+    for (i = 0; i < n; i++) {
+        if (stats[i].valid && stats[i].mem_valid) {
+            printmem(n, stats);
+            break;
+        }
+    }
+
+    /* Spread of the live set over pages and lines */
+    for (i = 0; i < n; i++) {
+        if (stats[i].valid && stats[i].loc_valid) {
+            printlocality(n, stats);
+            break;
+        }
+    }
+
+    /* Throughput with payload accesses */
+    for (i = 0; i < n; i++) {
+        if (stats[i].valid && stats[i].access_valid) {
+            printaccess(n, stats);
+            break;
+        }
+    }
+
+    /* Warm vs. cold cache throughput */
+    for (i = 0; i < n; i++) {
+        if (stats[i].valid && stats[i].cold_valid) {
+            printcold(n, stats);
+            break;
+        }
+    }
+}
+
+/*
+ * printlatency - prints the per-call latency percentiles (in cycles)
+ *                gathered by the latency pass.  In tab mode, there is
+ *                one row per op type and size class as well.
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i, type, c;
+
+    if (tab_mode) {
+        printf("op\tclass\tcount\tp50\tp99\tp99.9\tmax\ttrace\n");
+    } else {
+        printf("\nPer-call latency (cycles):\n");
+        printf("  %-27s %-27s %-27s\n",
+               "malloc p50/p99/p99.9/max",
+               "free p50/p99/p99.9/max",
+               "realloc p50/p99/p99.9/max");
+    }
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || !stats[i].lat_valid)
+            continue;
+        if (tab_mode) {
+            for (type = 0; type < LAT_OPTYPES; type++) {
+                lat_summary_t *lat = &stats[i].lat[type];
+                printf("%s\tall\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%s\n",
+                       lat_op_name[type], lat->count, lat->p50, lat->p99,
+                       lat->p999, lat->max, stats[i].filename);
+                for (c = 0; c < LAT_CLASSES; c++) {
+                    lat = &stats[i].lat_class[type][c];
+                    if (lat->count == 0)
+                        continue;
+                    printf("%s\t%s\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%s\n",
+                           lat_op_name[type], lat_class_name[c], lat->count,
+                           lat->p50, lat->p99, lat->p999, lat->max,
+                           stats[i].filename);
+                }
+            }
+            continue;
+        }
+        printf(" ");
+        for (type = 0; type < LAT_OPTYPES; type++) {
+            lat_summary_t *lat = &stats[i].lat[type];
+            if (lat->count == 0)
+                printf(" %27s", "--");
+            else
+                printf(" %5.0f %5.0f %6.0f %8.0f",
+                       lat->p50, lat->p99, lat->p999, lat->max);
+        }
+        printf("  %s\n", stats[i].filename);
+
+        /* Break down by request size when asked for more detail */
+        if (verbose > 1) {
+            for (c = 0; c < LAT_CLASSES; c++) {
+                printf("    %-6s", lat_class_name[c]);
+                for (type = 0; type < LAT_OPTYPES; type++) {
+                    lat_summary_t *lat = &stats[i].lat_class[type][c];
+                    if (lat->count == 0)
+                        printf(" %27s", "--");
+                    else
+                        printf(" %5.0f %5.0f %6.0f %8.0f",
+                               lat->p50, lat->p99, lat->p999, lat->max);
+                }
+                printf("\n");
+            }
+        }
+    }
+}
+
+/*
+ * cmp_window - Orders window numbers by decreasing cost, for qsort
+ */
+static const double *cmp_window_cycles;
+
+static int cmp_window(const void *a, const void *b)
+{
+    double ca = cmp_window_cycles[*(const long *) a];
+    double cb = cmp_window_cycles[*(const long *) b];
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/*
+ * printwindows - prints the WIN_TOP slowest windows of each trace, with
+ *                their request numbers and trace file line numbers,
+ *                and their cost relative to the trace's median window.
+ *                Tab mode prints every window instead.
+ */
+static void printwindows(int n, stats_t *stats)
+{
+    int i;
+    long w, k, *order;
+
+    if (tab_mode)
+        printf("window\tfirst_op\tlast_op\tfirst_line\tlast_line\tcyc_per_op\ttrace\n");
+    else
+        printf("\nSlowest windows of %ld requests (cycles per op):\n", win_ops);
+    for (i = 0; i < n; i++) {
+        stats_t *st = &stats[i];
+        long nwin = st->num_windows;
+        double median;
+
+        if (!st->valid || !st->win_valid)
+            continue;
+        if (tab_mode) {
+            for (w = 0; w < nwin; w++) {
+                long last = w == nwin - 1 ? (long) st->ops - 1 : (w + 1) * win_ops - 1;
+                printf("%ld\t%ld\t%ld\t%ld\t%ld\t%.1f\t%s\n", w, w * win_ops, last,
+                       LINENUM(w * win_ops), LINENUM(last), st->win_cycles[w],
+                       st->filename);
+            }
+            continue;
+        }
+
+        if ((order = (long *) malloc(nwin * sizeof(long))) == NULL)
+            unix_error("malloc failed in printwindows");
+        for (w = 0; w < nwin; w++)
+            order[w] = w;
+        cmp_window_cycles = st->win_cycles;
+        qsort(order, nwin, sizeof(long), cmp_window);
+        median = st->win_cycles[order[nwin / 2]];
+
+        printf("  %s: %ld windows, median %.1f\n", st->filename, nwin, median);
+        for (k = 0; k < nwin && k < WIN_TOP; k++) {
+            long first, last;
+            w = order[k];
+            first = w * win_ops;
+            last = w == nwin - 1 ? (long) st->ops - 1 : first + win_ops - 1;
+            printf("    ops %7ld-%-7ld lines %7ld-%-7ld %8.1f %6.1fx\n",
+                   first, last, LINENUM(first), LINENUM(last),
+                   st->win_cycles[w], median > 0 ? st->win_cycles[w] / median : 0.0);
+        }
+        free(order);
+    }
+}
+
+/*
+ * printperf - prints the performance counter rates per operation
+ *             measured while timing each trace.  Counters that could
+ *             not be read are shown as '--'.
+ */
+static void printperf(int n, stats_t *stats)
+{
+    int i, c;
+
+    if (tab_mode) {
+        for (c = 0; c < PC_NUM; c++)
+            printf("%s/op\t", perf_counter_name[c]);
+        printf("IPC\ttrace\n");
+    } else {
+        printf("\nPerformance counters (events per op):\n");
+        printf(" ");
+        for (c = 0; c < PC_NUM; c++)
+            printf(" %9s", perf_counter_name[c]);
+        printf(" %6s  %s\n", "IPC", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        double *perf = stats[i].perf;
+        if (!stats[i].valid || !stats[i].perf_valid)
+            continue;
+        if (!tab_mode)
+            printf(" ");
+        for (c = 0; c < PC_NUM; c++) {
+            if (tab_mode)
+                printf(perf[c] < 0 ? "\t" : "%.3f\t", perf[c]);
+            else if (perf[c] < 0)
+                printf(" %9s", "--");
+            else
+                printf(" %9.3f", perf[c]);
+        }
+        if (perf[PC_CYCLES] > 0 && perf[PC_INSTRUCTIONS] >= 0) {
+            double ipc = perf[PC_INSTRUCTIONS] / perf[PC_CYCLES];
+            printf(tab_mode ? "%.2f\t" : " %6.2f  ", ipc);
+        } else {
+            printf(tab_mode ? "\t" : " %6s  ", "--");
+        }
+        printf("%s\n", stats[i].filename);
+    }
+}
+
+/*
+ * printrobust - prints the median time of each trace along with the
+ *               spread of the samples and the confidence interval for
+ *               the median.  Traces whose interval never got narrow
+ *               enough are flagged.
+ */
+static void printrobust(int n, stats_t *stats)
+{
+    int i;
+    int unconverged = 0;
+
+    if (tab_mode) {
+        printf("msecs\tMAD\tci_lo\tci_hi\tsamples\tconverged\ttrace\n");
+    } else {
+        printf("\nTiming confidence (median of samples):\n");
+        printf("  %10s %7s %21s %7s %7s %5s  %s\n",
+               "msecs", "MAD", "95% CI (msecs)", "+/-", "samples", "conv", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        double med = stats[i].secs;
+        if (!stats[i].valid || !stats[i].robust_valid)
+            continue;
+        if (!stats[i].converged)
+            unconverged++;
+        if (tab_mode) {
+            printf("%.6f\t%.6f\t%.6f\t%.6f\t%ld\t%d\t%s\n",
+                   med * 1000.0, stats[i].mad * 1000.0,
+                   stats[i].ci_lo * 1000.0, stats[i].ci_hi * 1000.0,
+                   stats[i].samples, stats[i].converged, stats[i].filename);
+        } else {
+            double halfwidth = med > 0 ?
+                50.0 * (stats[i].ci_hi - stats[i].ci_lo) / med : 0;
+            double madpct = med > 0 ? 100.0 * stats[i].mad / med : 0;
+            printf("  %10.3f %6.1f%% %10.3f..%-9.3f %6.2f%% %7ld %5s  %s\n",
+                   med * 1000.0, madpct,
+                   stats[i].ci_lo * 1000.0, stats[i].ci_hi * 1000.0,
+                   halfwidth, stats[i].samples,
+                   stats[i].converged ? "yes" : "NO", stats[i].filename);
+        }
+    }
+    if (unconverged > 0 && !tab_mode)
+        printf("Warning: %d trace(s) did not converge within %d samples\n",
+               unconverged, ROBUST_MAXSAMPLES);
+}
+
+/*
+ * printcold - prints each trace's throughput with warm caches (the
+ *             usual measurement) next to its throughput when every
+ *             replay starts with flushed caches.
+ */
+static void printcold(int n, stats_t *stats)
+{
+    int i;
+
+    if (tab_mode) {
+        printf("warm Kops\tcold Kops\tcold/warm\ttrace\n");
+    } else {
+        printf("\nWarm vs. cold caches:\n");
+        printf("  %9s %9s %9s  %s\n", "warm Kops", "cold Kops", "cold/warm", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        double warm, cold;
+        if (!stats[i].valid || !stats[i].cold_valid)
+            continue;
+        warm = (stats[i].ops*1e-3)/stats[i].secs;
+        cold = (stats[i].ops*1e-3)/stats[i].secs_cold;
+        if (tab_mode)
+            printf("%.0f\t%.0f\t%.3f\t%s\n", warm, cold, cold/warm,
+                   stats[i].filename);
+        else
+            printf("  %9.0f %9.0f %9.3f  %s\n", warm, cold, cold/warm,
+                   stats[i].filename);
+    }
+}
+
+/*
+ * printmem - prints each trace's util and its peak and final heap
+ *            size next to the resident share of that heap, the part of
+ *            it on transparent huge pages, and the minor page faults it
+ *            took, on the first replay and per timed replay
+ */
+static void printmem(int n, stats_t *stats)
+{
+    int i;
+    double page = (double) mem_pagesize(), heap_pages;
+
+    if (tab_mode) {
+        printf("util\theap peak\theap final\tresident\thuge\tfaults first\tfaults timed\ttrace\n");
+    } else {
+        printf("\nResident memory and minor page faults");
+        if (heap_hugepage || heap_align || heap_populate > 0)
+            printf(" (heap%s%s, %zu bytes populated)", heap_hugepage ? " THP" : "",
+                   heap_align ? " 2MB-aligned" : "", heap_populate);
+        printf(":\n");
+        printf("  %6s %13s %13s %13s %6s %13s %11s %11s  %s\n", "util", "peak heap",
+               "final heap", "resident", "res%", "huge", "first flts", "timed flts",
+               "trace");
+    }
+    for (i = 0; i < n; i++) {
+        stats_t *st = &stats[i];
+        if (!st->valid || !st->mem_valid)
+            continue;
+        /* Residency is counted in whole pages, so compare it with those */
+        heap_pages = ceil(st->heap_final / page) * page;
+        if (tab_mode)
+            printf("%.1f\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.1f\t%s\n", st->util * 100.0,
+                   st->heap_peak, st->heap_final, st->resident, st->huge,
+                   st->faults_first, st->faults_timed, st->filename);
+        else
+            printf("  %5.1f%% %13.0f %13.0f %13.0f %5.1f%% %13.0f %11.0f %11.1f  %s\n",
+                   st->util * 100.0, st->heap_peak, st->heap_final, st->resident,
+                   heap_pages > 0 ? 100.0 * st->resident / heap_pages : 0.0,
+                   st->huge, st->faults_first, st->faults_timed, st->filename);
+    }
+}
+
+/*
+ * printlocality - prints the average and peak spread of each trace's
+ *                 live set over pages and cache lines
+ */
+static void printlocality(int n, stats_t *stats)
+{
+    int i;
+
+    if (tab_mode) {
+        printf("page avg\tpage max\tline avg\tline max\ttrace\n");
+    } else {
+        printf("\nLive set spread (pages or lines touched / minimum):\n");
+        printf("  %9s %9s %9s %9s  %s\n",
+               "page avg", "page max", "line avg", "line max", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        stats_t *st = &stats[i];
+        if (!st->valid || !st->loc_valid)
+            continue;
+        if (tab_mode)
+            printf("%.3f\t%.3f\t%.3f\t%.3f\t%s\n", st->page_spread_avg,
+                   st->page_spread_max, st->line_spread_avg, st->line_spread_max,
+                   st->filename);
+        else
+            printf("  %9.2f %9.2f %9.2f %9.2f  %s\n", st->page_spread_avg,
+                   st->page_spread_max, st->line_spread_avg, st->line_spread_max,
+                   st->filename);
+    }
+}
+
+/*
+ * printaccess - prints each trace's throughput as usually measured next
+ *               to its throughput when the replay also writes and
+ *               reads payloads.
+ */
+static void printaccess(int n, stats_t *stats)
+{
+    int i;
+
+    if (tab_mode) {
+        printf("Kops\taccess Kops\taccess/plain\ttrace\n");
+    } else {
+        printf("\nWith %.2g payload reads per request:\n", access_reads);
+        printf("  %9s %11s %12s  %s\n", "Kops", "access Kops", "access/plain", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        double plain, access;
+        if (!stats[i].valid || !stats[i].access_valid)
+            continue;
+        plain = (stats[i].ops*1e-3)/stats[i].secs;
+        access = (stats[i].ops*1e-3)/stats[i].secs_access;
+        if (tab_mode)
+            printf("%.0f\t%.0f\t%.3f\t%s\n", plain, access, access/plain,
+                   stats[i].filename);
+        else
+            printf("  %9.0f %11.0f %12.3f  %s\n", plain, access, access/plain,
+                   stats[i].filename);
     }
 }
 
@@ -1674,130 +3977,125 @@ static int cparse(char *s, char **index) {
     return found;
 }
 
-/* Read throughput from file */
-static double lookup_ref_throughput() {
+/*
+ * read_cpu_id - Find the processor model and microcode revision, which
+ *     together identify a cached reference throughput.  The microcode
+ *     is "unknown" where the kernel doesn't report it, as in many VMs.
+ */
+static bool read_cpu_id(char *cpu_type, char *microcode) {
     char buf[MAXLINE];
     char *tokens[PLIMIT];
-    char cpu_type[MAXLINE] = "";
-    double tput = 0.0;
-    char *bench_type = BENCH_KEY;
 
-    /* Scan file to find CPU type */
+    strcpy(cpu_type, "");
+    strcpy(microcode, "unknown");
     FILE *ifile = fopen(CPU_FILE, "r");
     if (!ifile) {
         fprintf(stderr, "Warning: Could not find file '%s'\n", CPU_FILE);
-        return tput;
+        return false;
     }
-    /* Read lines in file.  Parse each one to look for key */
-    bool found = false;
+    /* Read lines in file, up to the end of the first processor */
     while (fgets(buf, MAXLINE, ifile) != NULL) {
         int t = cparse(buf, tokens);
+        if (t == 1 && tokens[0][0] == 0 && cpu_type[0] != 0)
+            break;
         if (t < 2)
             continue;
-        if (strcmp(CPU_KEY, tokens[0]) == 0) {
+        if (strcmp(CPU_KEY, tokens[0]) == 0)
             strcpy(cpu_type, tokens[1]);
-            found = true;
-            break;
-        }
+        else if (strcmp(MICROCODE_KEY, tokens[0]) == 0)
+            strcpy(microcode, tokens[1]);
     }
     fclose(ifile);
-    if (!found) {
+    if (cpu_type[0] == 0) {
         fprintf(stderr, "Warning: Could not find CPU type in file '%s'\n", CPU_FILE);
-        return tput;
+        return false;
     }
-    /* Now try to find matching entry in throughput file */
+    return true;
+}
+
+/*
+ * lookup_ref_throughput - Find the cached reference throughput for this
+ *     processor.  Entries have the form cpu:microcode:benchmark:Kops.
+ *     Returns 0 if there is none.
+ */
+static double lookup_ref_throughput(const char *cpu_type, const char *microcode) {
+    char buf[MAXLINE];
+    char *tokens[PLIMIT];
+    double tput = 0.0;
+
     FILE *tfile = fopen(THROUGHPUT_FILE, "r");
-    if (tfile == NULL) {
-        fprintf(stderr, "Warning: Could not open throughput file '%s'\n", THROUGHPUT_FILE);
+    if (tfile == NULL)
         return tput;
-    }
-    found = false;
     while (fgets(buf, MAXLINE, tfile) != NULL) {
         int t = cparse(buf, tokens);
-        if (t < 3)
+        if (t < 4)
             continue;
         if (strcmp(tokens[0], cpu_type) == 0 &&
-            strcmp(tokens[1], bench_type) == 0) {
-            tput = atof(tokens[2]);
-            found = true;
+            strcmp(tokens[1], microcode) == 0 &&
+            strcmp(tokens[2], BENCH_KEY) == 0) {
+            tput = atof(tokens[3]);
             break;
         }
     }
     fclose(tfile);
-    if (tput == 0.0) {
-        fprintf(stderr, "Warning: Could not find CPU '%s' benchmark '%s' in throughput file '%s'\n",
-                cpu_type, bench_type, THROUGHPUT_FILE);
-    }
     if (tput > 0.0 && verbose > 0) {
-        printf("Found benchmark throughput %.0f for cpu type %s, benchmark %s\n",
-               tput, cpu_type, bench_type);
+        printf("Found benchmark throughput %.0f for cpu type %s, microcode %s, benchmark %s\n",
+               tput, cpu_type, microcode, BENCH_KEY);
     }
     return tput;
 }
 
 /*
- * gen_file_name: Generate a file name that does not currently exist
- * Give template suitable for use with snprintf, with one entry suitable for an integer value.
- * E.g., "./file_%.8x.txt".
+ * save_ref_throughput - Record the reference throughput for this
+ *     processor, replacing any earlier entry.  The file is rewritten
+ *     under a temporary name and renamed into place, so concurrent
+ *     runs never see it half written.
  */
-static char *gen_file_name(char *template, char *buf, int maxlen) {
-    
-    int r;
-    int lim = 100;
-    do {
-        r = random();
-        snprintf(buf, maxlen, template, r);
-        lim--;
-    } while (lim > 0 && access(buf, F_OK) == 0);
-    return lim > 0 ? buf : NULL;
-}
+static void save_ref_throughput(const char *cpu_type, const char *microcode,
+                                double tput) {
+    char buf[MAXLINE], line[MAXLINE];
+    char tmpname[MAXLINE];
+    char *tokens[PLIMIT];
+    FILE *tfile, *ofile;
 
-/*
- * measure_ref_throughput: Measure throughput achieved by reference implementation
- */
-static double measure_ref_throughput() {
-    double ltput = lookup_ref_throughput();
-    if (ltput > 0)
-        return ltput;
-    char buf[MAXLINE];
-    char cmd[MAXLINE];
-    char *fname = gen_file_name("./tput_%.8x.txt", buf, MAXLINE);
-    float t;
-    snprintf(cmd, MAXLINE, "%s > %s", REF_DRIVER,
-             fname);
-    if (verbose > 1) {
-        printf("Executing '%s'\n", cmd);
-    }
-    if (system(cmd) != 0) {
-        fprintf(stderr, "Couldn't execute '%s'\n", cmd);
-        exit(1);
-    }
-    FILE *f = fopen(fname, "r");
-    if (f == NULL) {
-        fprintf(stderr, "Couldn't open '%s'\n", fname);
-        exit(1);
-    }
-    if (fscanf(f, "%f", &t) != 1) {
-        fprintf(stderr, "Couldn't read result from '%s'\n", fname);
-        exit(1);
+    snprintf(tmpname, MAXLINE, "%s.%d", THROUGHPUT_FILE, (int) getpid());
+    if ((ofile = fopen(tmpname, "w")) == NULL) {
+        fprintf(stderr, "Warning: Could not write throughput file '%s'\n", tmpname);
+        return;
     }
-    if (fclose(f) != 0) {
-        fprintf(stderr, "Couldn't close '%s'\n", fname);
+    /* Copy all other entries */
+    if ((tfile = fopen(THROUGHPUT_FILE, "r")) != NULL) {
+        while (fgets(buf, MAXLINE, tfile) != NULL) {
+            strcpy(line, buf);
+            if (cparse(buf, tokens) >= 4 &&
+                strcmp(tokens[0], cpu_type) == 0 &&
+                strcmp(tokens[1], microcode) == 0 &&
+                strcmp(tokens[2], BENCH_KEY) == 0)
+                continue;
+            fputs(line, ofile);
+        }
+        fclose(tfile);
     }
-    snprintf(cmd, MAXLINE, "rm -f %s", fname);
-    if (system(cmd) != 0) {
-        fprintf(stderr, "Couldn't delete '%s'\n", fname);
+    fprintf(ofile, "%s:%s:%s:%.0f\n", cpu_type, microcode, BENCH_KEY, tput);
+    if (fclose(ofile) != 0 || rename(tmpname, THROUGHPUT_FILE) != 0) {
+        fprintf(stderr, "Warning: Could not save throughput file '%s'\n", THROUGHPUT_FILE);
+        unlink(tmpname);
+        return;
     }
-    return (double) t;
+    if (verbose > 0)
+        printf("Saved benchmark throughput %.0f for cpu type %s, microcode %s, benchmark %s\n",
+               tput, cpu_type, microcode, BENCH_KEY);
 }
 
-
 /*
  * usage - Explain the command line arguments
  */
 static void usage(char *prog)
 {
-    fprintf(stderr, "Usage: %s [-hlVdD] [-f <file>]\n", prog);
+    fprintf(stderr, "Usage: %s [-hlVdDTLPCKFgrHG] [-R <pct>] [-f <file>]\n"
+                    "       [-j <file>] [-b <file> [-e <pct>]] [-u <file> [-w <ops>]]\n"
+                    "       [-W <ops>] [-a <passes>] [-m <mode>] [-x <reads>] [-p <bytes>]\n", prog);
+    fprintf(stderr, "       %s -A <a.so> -B <b.so> [-N <n>] [-f <file>]\n", prog);
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
@@ -1810,4 +4108,28 @@ static void usage(char *prog)
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+    fprintf(stderr, "\t-F         Add the fragmentation traces to the default traces\n");
+    fprintf(stderr, "\t-u <file>  Write a utilization and fragmentation timeline as CSV\n");
+    fprintf(stderr, "\t-w <ops>   Requests per row of the timeline (default %d)\n", UTIL_WINDOW);
+    fprintf(stderr, "\t-L         Measure per-call latency percentiles\n");
+    fprintf(stderr, "\t-r         Report peak and final heap, resident memory and minor page faults\n");
+    fprintf(stderr, "\t-g         Measure how many pages and lines the live blocks span\n");
+    fprintf(stderr, "\t-H         Advise transparent huge pages on the heap (implies -r)\n");
+    fprintf(stderr, "\t-G         Align the heap base to a 2MB huge page (implies -r)\n");
+    fprintf(stderr, "\t-p <n>     Pre-fault the first <n> bytes (or <n>K, M, G) of the heap (implies -r)\n");
+    fprintf(stderr, "\t-W <ops>   Time windows of <ops> requests and show the slowest\n");
+    fprintf(stderr, "\t-P         Read hardware performance counters while timing\n");
+    fprintf(stderr, "\t-R <pct>   Time with medians, sampling until the 95%% CI is < <pct>%% wide\n");
+    fprintf(stderr, "\t-C         Also time each trace starting from cold caches\n");
+    fprintf(stderr, "\t-x <n>     Also time with payload writes and <n> reads per request\n");
+    fprintf(stderr, "\t-A <so>    With -B, compare allocators built with 'make <name>.so'\n");
+    fprintf(stderr, "\t-B <so>    Allocator B of the A/B comparison\n");
+    fprintf(stderr, "\t-N <n>     Number of interleaved A/B rounds (default %d)\n", AB_ROUNDS);
+    fprintf(stderr, "\t-a <n>     Replay the traces <n> times on one heap, without mm_init\n");
+    fprintf(stderr, "\t-m <mode>  Interleave the traces on one heap: rr, random or weighted\n");
+    fprintf(stderr, "\t-K         Recalibrate the reference throughput for this CPU\n");
+    fprintf(stderr, "\t-j <file>  Write the results as JSON to <file> (- for stdout; other output then goes to stderr)\n");
+    fprintf(stderr, "\t-b <file>  Exit with status 1 if util or Kops regress from JSON <file>\n");
+    fprintf(stderr, "\t-e <pct>   Kops tolerance for -b traces without kops_tol (default %.0f%%)\n",
+            KOPS_TOLERANCE * 100);
 }
@@ -4,6 +4,7 @@
  * package with the system's malloc package in libc.
  *
  */
+#define _GNU_SOURCE             /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -18,17 +19,56 @@
 #include "memlib.h"
 #include "config.h"
 
+#define HUGE_ALIGN (2ul << 20)      /* size of an x86-64 huge page */
+
 /* private global variables */
 static unsigned char *heap;                 /* Starting address of heap */
 static unsigned char *mem_brk;              /* Current position of break */
 static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
 
+/*
+ * Regions handed out by mem_mmap, sorted by address.  They are carved
+ * down from the top of the reservation, so the heap may grow up to the
+ * lowest of them, and the gaps between them are reused first fit.
+ */
+typedef struct {
+    unsigned char *addr;
+    size_t len;
+} region_t;
+
+static region_t *maps;
+static int num_maps = 0;
+static int max_maps = 0;
+static size_t mapped_bytes = 0;
+
+/* Lowest mapped address, which bounds the heap */
+static unsigned char *map_floor(void) {
+    return num_maps > 0 ? maps[0].addr : mem_max_addr;
+}
+
+/* Options for the heap mapping, set with mem_options before mem_init */
+static bool opt_hugepage = false;           /* madvise(MADV_HUGEPAGE) */
+static bool opt_align = false;              /* base aligned to HUGE_ALIGN */
+static size_t opt_populate = 0;             /* bytes to map with MAP_POPULATE */
+
+/*
+ * mem_options - choose how mem_init maps the heap: with transparent
+ *		huge pages advised, at a base aligned to a 2MB huge page,
+ *		and with the first populate bytes faulted in up front
+ */
+void mem_options(bool hugepage, bool align, size_t populate) {
+    opt_hugepage = hugepage;
+    opt_align = align;
+    opt_populate = populate;
+}
+
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(){
+    size_t slack = opt_align ? HUGE_ALIGN : 0;
     unsigned char* addr = mmap(NULL,                                        /* start*/
-                               MAX_HEAP_SIZE,                               /* length */
+                               MAX_HEAP_SIZE + slack,                       /* length */
                                PROT_READ | PROT_WRITE,                      /* permissions */
                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, /* flags */
                                -1,                                          /* fd */
@@ -37,6 +77,41 @@ void mem_init(){
 	fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
 	exit(1);
     }
+
+    /* Trim the slack to leave MAX_HEAP_SIZE bytes at an aligned base */
+    if (opt_align) {
+	unsigned char *base = (unsigned char *)
+	    (((uintptr_t) addr + HUGE_ALIGN - 1) & ~(uintptr_t) (HUGE_ALIGN - 1));
+	size_t lead = base - addr;
+	if ((lead > 0 && munmap(addr, lead) != 0) ||
+	    (slack > lead && munmap(base + MAX_HEAP_SIZE, slack - lead) != 0)) {
+	    fprintf(stderr, "FAILURE.  munmap couldn't align the heap\n");
+	    exit(1);
+	}
+	addr = base;
+    }
+
+    /*
+     * MAP_POPULATE only works when mapping, so the prefix is mapped
+     * again over the reservation.  Its pages are faulted in before any
+     * advice, so they are huge only if THP is enabled for everything.
+     */
+    if (opt_populate > 0) {
+	size_t page = mem_pagesize();
+	size_t len = (opt_populate + page - 1) & ~(page - 1);
+	if (len > MAX_HEAP_SIZE)
+	    len = MAX_HEAP_SIZE;
+	if (mmap(addr, len, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED | MAP_POPULATE,
+		 -1, 0) == MAP_FAILED) {
+	    fprintf(stderr, "FAILURE.  mmap couldn't populate the heap\n");
+	    exit(1);
+	}
+    }
+    if (opt_hugepage && madvise(addr, MAX_HEAP_SIZE, MADV_HUGEPAGE) != 0)
+	fprintf(stderr, "WARNING: madvise(MADV_HUGEPAGE) failed on the heap: %s\n",
+		strerror(errno));
+
     heap = addr;
     mem_max_addr = addr + MAX_HEAP_SIZE;
     mem_reset_brk();
@@ -50,28 +125,45 @@ void mem_deinit(void){
         fprintf(stderr, "FAILURE.  munmap couldn't deallocate heap space\n");
         exit(1);
     }
+    num_maps = 0;
+    mapped_bytes = 0;
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
 void mem_reset_brk(){
+    int i;
+
     mem_brk = heap;
+    /* Regions left mapped by the last run go, so mem_mmap returns zeros */
+    for (i = 0; i < num_maps; i++)
+	mem_purge(maps[i].addr, maps[i].len);
+    num_maps = 0;
+    mapped_bytes = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		by incr bytes and returns the start address of the new area.
+ *		A negative incr shrinks the heap, like sbrk, and returns the
+ *		old break.  Whole pages above the new break are given back
+ *		with mem_purge, and read as zero if the heap grows over
+ *		them again.
  */
 void *mem_sbrk(intptr_t incr) {
     unsigned char *old_brk = mem_brk;
 
     bool ok = true;
     if (incr < 0) {
-	ok = false;
-	fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
-    } else if (mem_brk + incr > mem_max_addr) {
+	if (mem_brk - heap < -incr) {
+	    ok = false;
+	    fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to shrink heap of %zu bytes by %ld\n",
+		    (size_t) (mem_brk - heap), (long) -incr);
+	} else {
+	    mem_purge(mem_brk + incr, (size_t) -incr);
+	}
+    } else if (mem_brk + incr > map_floor()) {
 	ok = false;
 	long alloc = mem_brk - heap + incr;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
@@ -85,6 +177,238 @@ void *mem_sbrk(intptr_t incr) {
     }
 }
 
+/*
+ * mem_purge - give the whole pages in [addr, addr + len) back to the
+ *		system with MADV_DONTNEED.  They stay part of the heap, and
+ *		read as zero when next touched.  Returns the bytes released.
+ */
+size_t mem_purge(void *addr, size_t len) {
+    size_t page = mem_pagesize();
+    uintptr_t lo = ((uintptr_t) addr + page - 1) & ~(uintptr_t) (page - 1);
+    uintptr_t hi = ((uintptr_t) addr + len) & ~(uintptr_t) (page - 1);
+
+    if (hi <= lo)
+	return 0;
+    if (madvise((void *) lo, hi - lo, MADV_DONTNEED) != 0) {
+	fprintf(stderr, "FAILURE.  madvise couldn't release heap pages\n");
+	exit(1);
+    }
+    return hi - lo;
+}
+
+/*
+ * find_gap - Choose where a region of len bytes, a whole number of
+ *		pages, would go: first fit in the gaps between regions, from
+ *		the top down, else below the lowest.  Returns the index it
+ *		would have in maps, with its address in *addr, or -1.
+ */
+static int find_gap(size_t len, unsigned char **addr) {
+    unsigned char *top = mem_max_addr;
+    int i;
+
+    for (i = num_maps - 1; i >= 0; i--) {
+	if ((size_t) (top - (maps[i].addr + maps[i].len)) >= len) {
+	    *addr = top - len;
+	    return i + 1;
+	}
+	top = maps[i].addr;
+    }
+    if ((size_t) (top - mem_brk) < len)
+	return -1;
+    *addr = top - len;
+    return 0;
+}
+
+/* Record a region at index pos of maps */
+static void insert_map(int pos, unsigned char *addr, size_t len) {
+    if (num_maps == max_maps) {
+	region_t *m;
+	max_maps = max_maps ? 2 * max_maps : 64;
+	if ((m = realloc(maps, max_maps * sizeof(region_t))) == NULL) {
+	    fprintf(stderr, "FAILURE.  realloc failed in mem_mmap\n");
+	    exit(1);
+	}
+	maps = m;
+    }
+    memmove(&maps[pos + 1], &maps[pos], (num_maps - pos) * sizeof(region_t));
+    maps[pos].addr = addr;
+    maps[pos].len = len;
+    num_maps++;
+    mapped_bytes += len;
+}
+
+/* Forget the region at index pos of maps */
+static void remove_map(int pos) {
+    mapped_bytes -= maps[pos].len;
+    memmove(&maps[pos], &maps[pos + 1], (num_maps - pos - 1) * sizeof(region_t));
+    num_maps--;
+}
+
+/*
+ * mem_mmap - simple model of an anonymous mmap.  Returns a page-aligned
+ *		region of len bytes, rounded up to whole pages, that reads
+ *		as zero.  Regions come from the top of the reservation and
+ *		the heap cannot grow into them.
+ */
+void *mem_mmap(size_t len) {
+    size_t page = mem_pagesize();
+    unsigned char *addr;
+    int pos;
+
+    len = (len + page - 1) & ~(page - 1);
+    if (len == 0 || len > (size_t) (mem_max_addr - heap)) {
+	errno = ENOMEM;
+	return (void *) -1;
+    }
+    if ((pos = find_gap(len, &addr)) < 0) {
+	fprintf(stderr, "ERROR: mem_mmap failed.  Ran out of memory for %zu bytes\n", len);
+	errno = ENOMEM;
+	return (void *) -1;
+    }
+    insert_map(pos, addr, len);
+    return addr;
+}
+
+/* Index of the region starting at addr, or -1 */
+static int find_map(const unsigned char *addr) {
+    int lo = 0, hi = num_maps - 1;
+
+    while (lo <= hi) {
+	int mid = (lo + hi) / 2;
+	if (maps[mid].addr == addr)
+	    return mid;
+	if (maps[mid].addr < addr)
+	    lo = mid + 1;
+	else
+	    hi = mid - 1;
+    }
+    return -1;
+}
+
+/*
+ * mem_munmap - release a whole region returned by mem_mmap.  Its pages
+ *		go back to the system.  Returns 0, or -1 if addr and len
+ *		are not those of a region.
+ */
+int mem_munmap(void *addr, size_t len) {
+    size_t page = mem_pagesize();
+    int i = find_map(addr);
+
+    len = (len + page - 1) & ~(page - 1);
+    if (i < 0 || maps[i].len != len) {
+	fprintf(stderr, "ERROR: mem_munmap failed.  No region of %zu bytes at %p\n", len, addr);
+	errno = EINVAL;
+	return -1;
+    }
+    mem_purge(addr, len);
+    remove_map(i);
+    return 0;
+}
+
+/*
+ * move_pages - Move len bytes of pages from old to dst with mremap.
+ *		Earlier moves split the reservation into several mappings,
+ *		which mremap cannot cross, so a range that fails with
+ *		EFAULT is moved in halves.
+ */
+static void move_pages(unsigned char *old, unsigned char *dst, size_t len) {
+    size_t page = mem_pagesize();
+    size_t half;
+
+    if (mremap(old, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, dst) != MAP_FAILED)
+	return;
+    if (errno != EFAULT || len == page) {
+	fprintf(stderr, "FAILURE.  mremap couldn't move a region: %s\n", strerror(errno));
+	exit(1);
+    }
+    half = (len / 2) & ~(page - 1);
+    if (half == 0)
+	half = page;
+    move_pages(old, dst, half);
+    move_pages(old + half, dst + half, len - half);
+}
+
+/*
+ * mem_mremap - simple model of mremap with MREMAP_MAYMOVE.  Resizes a
+ *		region from mem_mmap to new_len bytes, rounded up to whole
+ *		pages.  It shrinks or grows in place when it can; otherwise
+ *		its pages are moved to a new gap with mremap(MREMAP_FIXED),
+ *		which costs page table updates rather than a copy, and the
+ *		hole left behind is mapped again, with the huge page advice
+ *		mem_init gave the heap, if any.  The rest of the gap reads
+ *		as zero, like every gap.  Returns the region's address, or
+ *		(void *) -1 with errno set.
+ */
+void *mem_mremap(void *addr, size_t old_len, size_t new_len) {
+    size_t page = mem_pagesize();
+    unsigned char *old = addr, *top, *new_addr;
+    int i = find_map(addr), pos;
+
+    old_len = (old_len + page - 1) & ~(page - 1);
+    new_len = (new_len + page - 1) & ~(page - 1);
+    if (i < 0 || maps[i].len != old_len || new_len == 0) {
+	fprintf(stderr, "ERROR: mem_mremap failed.  No region of %zu bytes at %p\n", old_len, addr);
+	errno = EINVAL;
+	return (void *) -1;
+    }
+
+    /* Shrink, or grow into the gap above */
+    top = i + 1 < num_maps ? maps[i + 1].addr : mem_max_addr;
+    if (new_len <= old_len || (size_t) (top - old) >= new_len) {
+	if (new_len < old_len)
+	    mem_purge(old + new_len, old_len - new_len);
+	mapped_bytes += new_len - old_len;
+	maps[i].len = new_len;
+	return addr;
+    }
+
+    /* Move to a gap, which cannot overlap the region itself */
+    if ((pos = find_gap(new_len, &new_addr)) < 0) {
+	fprintf(stderr, "ERROR: mem_mremap failed.  Ran out of memory for %zu bytes\n", new_len);
+	errno = ENOMEM;
+	return (void *) -1;
+    }
+    move_pages(old, new_addr, old_len);
+    if (mmap(old, old_len, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+	fprintf(stderr, "FAILURE.  mmap couldn't fill the hole left by mremap\n");
+	exit(1);
+    }
+    /* The new mapping does not inherit the heap's huge page advice */
+    if (opt_hugepage && madvise(old, old_len, MADV_HUGEPAGE) != 0)
+	fprintf(stderr, "WARNING: madvise(MADV_HUGEPAGE) failed on the hole left by mremap: %s\n",
+		strerror(errno));
+    remove_map(i);
+    insert_map(pos > i ? pos - 1 : pos, new_addr, new_len);
+    return new_addr;
+}
+
+/*
+ * mem_mapsize - returns the bytes in regions from mem_mmap
+ */
+size_t mem_mapsize(void) {
+    return mapped_bytes;
+}
+
+/*
+ * mem_is_mapped - returns whether [lo, hi] lies within one region from
+ *		mem_mmap
+ */
+bool mem_is_mapped(const void *lo, const void *hi) {
+    const unsigned char *l = lo, *h = hi;
+    int a = 0, b = num_maps - 1;
+
+    /* Find the last region starting at or below lo */
+    while (a <= b) {
+	int mid = (a + b) / 2;
+	if (maps[mid].addr <= l)
+	    a = mid + 1;
+	else
+	    b = mid - 1;
+    }
+    return b >= 0 && h >= l && h < maps[b].addr + maps[b].len;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -113,6 +437,75 @@ size_t mem_pagesize(){
     return (size_t) getpagesize();
 }
 
+/* Bytes of [addr, addr + len) in physical memory, len a multiple of the page */
+static size_t resident_bytes(unsigned char *addr, size_t len) {
+    size_t page = mem_pagesize();
+    size_t pages = len / page;
+    size_t chunk = 1 << 20;            /* pages per mincore call */
+    size_t resident = 0;
+    size_t i, j, n;
+    unsigned char *vec = malloc(pages < chunk ? (pages ? pages : 1) : chunk);
+
+    if (vec == NULL) {
+	fprintf(stderr, "FAILURE.  malloc failed in mem_resident\n");
+	exit(1);
+    }
+    for (i = 0; i < pages; i += n) {
+	n = pages - i < chunk ? pages - i : chunk;
+	if (mincore(addr + i * page, n * page, vec) != 0) {
+	    fprintf(stderr, "FAILURE.  mincore failed on the heap\n");
+	    exit(1);
+	}
+	for (j = 0; j < n; j++)
+	    resident += vec[j] & 1;
+    }
+    free(vec);
+    return resident * page;
+}
+
+/*
+ * mem_resident - returns the number of bytes of the heap, up to the
+ *		break, and of the regions from mem_mmap that are in
+ *		physical memory.  The heap is mapped MAP_NORESERVE, so only
+ *		pages that have been touched count, and heap pages stay
+ *		resident after mem_reset_brk.
+ */
+size_t mem_resident(void) {
+    size_t page = mem_pagesize();
+    size_t resident = resident_bytes(heap, (mem_heapsize() + page - 1) & ~(page - 1));
+    int i;
+
+    for (i = 0; i < num_maps; i++)
+	resident += resident_bytes(maps[i].addr, maps[i].len);
+    return resident;
+}
+
+/*
+ * mem_hugepages - returns the bytes of the heap and its regions backed
+ *		by transparent huge pages, the AnonHugePages of the mappings
+ *		in the reservation according to /proc/self/smaps, or 0 if
+ *		that cannot be read
+ */
+size_t mem_hugepages(void) {
+    FILE *f = fopen("/proc/self/smaps", "r");
+    char line[256];
+    bool inside = false;
+    size_t huge = 0;
+
+    if (f == NULL)
+	return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+	unsigned long lo, hi;
+	size_t kb;
+	if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2)
+	    inside = lo < (uintptr_t) mem_max_addr && hi > (uintptr_t) heap;
+	else if (inside && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+	    huge += kb * 1024;
+    }
+    fclose(f);
+    return huge;
+}
+
 /*************** Memory emulation  *******************/
 
 /* Read len bytes and return value zero-extended to 64 bits */
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+void mem_options(bool hugepage, bool align, size_t populate); /* call before mem_init */
 void mem_init();               
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
@@ -10,6 +11,14 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+size_t mem_resident(void);     /* bytes of the heap and regions in physical memory */
+size_t mem_purge(void *addr, size_t len); /* release whole pages, which read as zero */
+void *mem_mmap(size_t len);    /* page-aligned region outside the heap */
+int mem_munmap(void *addr, size_t len);
+void *mem_mremap(void *addr, size_t old_len, size_t new_len); /* may move the region */
+size_t mem_mapsize(void);      /* bytes in regions from mem_mmap */
+bool mem_is_mapped(const void *lo, const void *hi);
+size_t mem_hugepages(void);    /* bytes of heap and regions on huge pages */
 
 /* Functions used for memory emulation */
 
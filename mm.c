@@ -35,6 +35,35 @@
  * and when the heap is extended. These blocks are then marked as free using the free()
  * function which then allows them to be used in realloc() or new malloc() calls.
  * 
+ * Heap trimming - Usage of mm_trim()
+ * When the free block at the end of the heap is bigger than TRIM_THRESHOLD, all but
+ * TRIM_PAD bytes of it are given back with a negative mem_sbrk. It is not trimmed as
+ * soon as it is freed: free blocks of PURGE_THRESHOLD bytes or more record how many
+ * bytes malloc had served when they entered a free list, and every IDLE_STEP bytes
+ * malloc trims the last block only if it has stayed free for TRIM_IDLE bytes since.
+ * A heap that shrinks and grows back within that interval keeps its pages, rather
+ * than giving them back and faulting them in again.
+ *
+ * Purging free pages - Usage of mem_purge()
+ * Free blocks of PURGE_THRESHOLD bytes or more have the whole pages inside them given
+ * back to the system, and are marked with the PURGED bit in their header and footer.
+ * Like trimming, a purge waits for the idle check in malloc, and takes only blocks that
+ * have stayed free for PURGE_IDLE bytes, so a block that is freed and soon reused is
+ * not purged and faulted back in each time. Nor is the block that malloc would hand
+ * to another request of the last size it served.
+ * Splitting keeps the bit on the remainder, and coalescing clears it. calloc() need not
+ * zero the purged pages of a block, since they read as zero.
+ *
+ * Large blocks - Usage of mem_mmap()
+ * Requests of MMAP_THRESHOLD bytes or more are not served from the heap. Each gets a
+ * region of its own from mem_mmap(), rounded up to whole pages, with the payload
+ * ALIGNMENT bytes in and a header before it marked allocated and MMAPPED. They never
+ * enter the free lists, and free() hands the region straight back with mem_munmap().
+ * realloc() resizes them with mem_mremap(), so growing one never copies its payload.
+ * The price is a system call or two for every large malloc, free and realloc, where
+ * the heap would often need none: util is far higher on traces of large blocks, but
+ * throughput on them is far lower.
+ *
  * Memory Reallocation - Usage of realloc()
  * The realloc function tries to expand the current block in place when
  * possible. If this is not feasible, it allocates a new block, transfers
@@ -109,12 +138,25 @@
 #define HEAP_MULTIPLIER 2              // Extend heap by this multiple of the requested size
 #define MIN_BLOCK_SIZE 2               // Smallest possible size for a free block
 #define MAX_LIST_POS  (ALIGNMENT - 1)  // Constant for highest position in the segregated list
+#define TRIM_THRESHOLD (128 * 1024)    // The heap is trimmed when the last free block is bigger than this
+#define TRIM_PAD HEAP_EXTENSION        // ... keeping this much of it, so the next malloc needn't extend
+#define TRIM_IDLE (4 * 1024 * 1024)    // ... once it has stayed free while malloc served this many bytes
+#define IDLE_STEP (1024 * 1024)        // malloc checks for idle free blocks each time it serves this many bytes
+#define PURGE_THRESHOLD (64 * 1024)    // Free blocks this big have their interior pages purged
+#define PURGE_IDLE (4 * 1024 * 1024)   // ... once they have stayed free while malloc served this many bytes
+#define PURGED 0x2                     // Header/footer bit of a free block whose interior pages are purged
+#define MMAPPED 0x4                    // Header bit of a block in a region of its own from mem_mmap
+#define MMAP_THRESHOLD (128 * 1024)    // Requests this big get such a region
 
 // GLobal variables [TODO]
 static char *heap_list_ptr;                                      // The first pointer to the heap block
 static void remove_from_tree(void *block_ptr);                   // Removes a given pointer from the tree we are building
 static void insert_to_tree(void *block_ptr, size_t block_size);  // Adds a given pointer to the tree we are building
 static void *free_list[ALIGNMENT];                               // Define the free_list array of size (ALIGNMENT --> 16) 
+static char *zero_lo, *zero_hi;                                  // Range of the last placed block known to read as zero
+static size_t alloc_clock;                                       // Bytes served by malloc since mm_init
+static size_t idle_check_at;                                     // alloc_clock at which malloc next checks for idle blocks
+static size_t last_size;                                         // Adjusted size of the last request served from the heap
 
 // Use static inline functions instead of using macros. [TODO]
 // Pack size and allocation bit into a single word to store in the header/footer
@@ -153,6 +195,25 @@ static inline size_t get_alloc(const void* ptr)
     return (read_word(ptr) & 0x1);
 }
 
+// Extract the purged bit from the header or footer of a free block
+static inline size_t get_purged(const void* ptr)
+{
+    return (read_word(ptr) & PURGED);
+}
+
+// Extract the mmapped bit from the header of an allocated block
+static inline size_t get_mmapped(const void* ptr)
+{
+    return (read_word(ptr) & MMAPPED);
+}
+
+// A free block of PURGE_THRESHOLD bytes or more keeps the alloc_clock it has been
+// idle since in the word after its list pointers
+static inline size_t *free_stamp(void* block_ptr)
+{
+    return (size_t *)((char *)block_ptr + 2 * WORD_SIZE);
+}
+
 // Given a block pointer, compute the address of the block's header
 // The header is stored just before the block's payload
 static inline void* header(const void* block_ptr) 
@@ -219,6 +280,23 @@ static inline void* prev_block(const void* block_ptr)
     return (void*)((char*)block_ptr - get_size((char*)block_ptr - ALIGNMENT));  
 }
 
+// The older of two free stamps
+static inline size_t smaller_stamp(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+// The alloc_clock a free block has been idle since, which for one too small to
+// carry a stamp is now
+static inline size_t idle_since(void* block_ptr)
+{
+    if (get_size(header(block_ptr)) < PURGE_THRESHOLD)
+    {
+        return alloc_clock;
+    }
+    return *free_stamp(block_ptr);
+}
+
 /* rounds up to the nearest multiple of ALIGNMENT */
 static size_t align(size_t x)
 {
@@ -316,6 +394,75 @@ static void* mem_block_size(size_t required_size)
     return NULL;
 }
 
+/*
+ * Compute the whole pages of a free block that lie past its list pointers and
+ * free stamp and before its footer, which are the ones a purge releases
+ */
+static void purge_range(void *block_ptr, size_t block_size, char **lo, char **hi)
+{
+    uintptr_t page = mem_pagesize();
+    uintptr_t start = (uintptr_t)block_ptr + 3 * WORD_SIZE;
+    uintptr_t end = (uintptr_t)block_ptr + block_size - ALIGNMENT;
+
+    *lo = (char *)((start + page - 1) & ~(page - 1));
+    *hi = (char *)(end & ~(page - 1));
+    if (*hi < *lo)
+    {
+        *hi = *lo;
+    }
+}
+
+/*
+ * Release the interior pages of a free block and mark it purged
+ */
+static void purge_block(void *block_ptr)
+{
+    size_t block_size = get_size(header(block_ptr));
+    char *lo, *hi;
+
+    purge_range(block_ptr, block_size, &lo, &hi);
+    mem_purge(lo, hi - lo);
+    write_word(header(block_ptr), pack(block_size, PURGED));
+    write_word(footer(block_ptr), pack(block_size, PURGED));
+}
+
+/*
+ * Called by malloc each time it has served IDLE_STEP more bytes. Shrinks the heap
+ * if its last block is a large free block that has stayed free for TRIM_IDLE bytes,
+ * then purges the large free blocks that have stayed free for PURGE_IDLE bytes.
+ */
+static void idle_check(void)
+{
+    idle_check_at = alloc_clock + IDLE_STEP;
+
+    // The epilogue header is the last word of the heap, and the last block's footer precedes it
+    char *tail_footer = (char *)mem_heap_hi() + 1 - 2 * WORD_SIZE;
+    size_t tail_size = get_size(tail_footer);
+    if (!get_alloc(tail_footer) && tail_size > TRIM_THRESHOLD)
+    {
+        void *tail_block = tail_footer + 2 * WORD_SIZE - tail_size;
+        if (alloc_clock - *free_stamp(tail_block) >= TRIM_IDLE)
+        {
+            mm_trim(TRIM_PAD);
+        }
+    }
+
+    // Blocks of PURGE_THRESHOLD bytes or more are all on the last list. Spare the
+    // one the next request of the last size would take.
+    void *next_fit = mem_block_size(last_size);
+    for (void *block_ptr = free_list[MAX_LIST_POS]; block_ptr != NULL;
+         block_ptr = get_previous_block(block_ptr))
+    {
+        if (block_ptr != next_fit &&
+            get_size(header(block_ptr)) >= PURGE_THRESHOLD &&
+            !get_purged(header(block_ptr)) &&
+            alloc_clock - *free_stamp(block_ptr) >= PURGE_IDLE)
+        {
+            purge_block(block_ptr);
+        }
+    }
+}
+
 /*
  * Place the requested block at the start of the free block
  * and split the block if the remainder is large enough.
@@ -326,6 +473,16 @@ static void *place(void *block_ptr, size_t adjusted_size) {
 
     // Calculate the remaining size after allocating the requested size
     size_t remaining_size = current_size - adjusted_size;
+    size_t purged = get_purged(header(block_ptr));
+    size_t stamp = idle_since(block_ptr);
+
+    // The purged pages of the block read as zero until the caller writes them
+    zero_lo = NULL;
+    zero_hi = NULL;
+    if (purged)
+    {
+        purge_range(block_ptr, current_size, &zero_lo, &zero_hi);
+    }
 
     // Remove the block from the free list as we are about to allocate it
     remove_from_tree(block_ptr);
@@ -340,12 +497,18 @@ static void *place(void *block_ptr, size_t adjusted_size) {
         // Calculate the location for the remaining free block
         void *free_block_ptr = next_block(block_ptr);
 
-        // Set the header and footer for the new free block
-        write_word(header(free_block_ptr), pack(remaining_size, 0));  // Free block header
-        write_word(footer(free_block_ptr), pack(remaining_size, 0));  // Free block footer
+        // Set the header and footer for the new free block, whose pages past its
+        // list pointers are still purged
+        write_word(header(free_block_ptr), pack(remaining_size, purged));  // Free block header
+        write_word(footer(free_block_ptr), pack(remaining_size, purged));  // Free block footer
 
-        // Insert the new free block into the free list
+        // Insert the new free block into the free list. Its pages have not been
+        // touched, so it stays idle since the whole block was
         insert_to_tree(free_block_ptr, remaining_size);
+        if (remaining_size >= PURGE_THRESHOLD)
+        {
+            *free_stamp(free_block_ptr) = stamp;
+        }
     } else
     {
         // Allocate the entire block without splitting
@@ -390,10 +553,12 @@ static void *coalesce_mem(void *block_ptr)
     }
 
     // Remove the current block from the free list
+    size_t stamp = idle_since(block_ptr);
     remove_from_tree(block_ptr);
 
     // Coalesce with the next block (ONLY IFnext block is free)
     if (!next_alloc) {
+        stamp = smaller_stamp(stamp, idle_since(next_block(block_ptr)));
         size_t next_block_size = get_size(header(next_block(block_ptr)));
         size_t block_size = get_size(header(block_ptr)) + next_block_size;
 
@@ -406,6 +571,7 @@ static void *coalesce_mem(void *block_ptr)
     if (!prev_alloc) {
         // Store the previous block pointer to avoid recalculating it multiple times
         void *prev_block_ptr = prev_block(block_ptr);
+        stamp = smaller_stamp(stamp, idle_since(prev_block_ptr));
 
         // Calculate the combined block size by getting the sizes of the current and previous blocks
         size_t prev_block_size = get_size(header(prev_block_ptr));
@@ -418,8 +584,13 @@ static void *coalesce_mem(void *block_ptr)
         block_ptr = prev_block(block_ptr);  // Move block pointer to previous block
     }
 
-    // Insert the coalesced block back into the free list
+    // Insert the coalesced block back into the free list, idle since the
+    // oldest of its parts, so that extending a free tail does not make it new
     insert_to_tree(block_ptr, get_size(header(block_ptr)));
+    if (get_size(header(block_ptr)) >= PURGE_THRESHOLD)
+    {
+        *free_stamp(block_ptr) = stamp;
+    }
 
     return block_ptr;  // Return the pointer to the coalesced block
 }
@@ -474,6 +645,9 @@ bool mm_init(void)
 
     // Initialize the segregated free list to NULL using memset
     memset(free_list, 0, sizeof(free_list));
+    alloc_clock = 0;
+    idle_check_at = IDLE_STEP;
+    last_size = 0;
 
     // Padding operation before alignment, adding pointless alignment check
     int extra_padding = WORD_SIZE;  
@@ -507,6 +681,32 @@ bool mm_init(void)
     return true;
 }
 
+/*
+ * Serve a large request from a region of its own. The region holds the
+ * header and payload, rounded up to whole pages, and reads as zero.
+ */
+static void *map_block(size_t size)
+{
+    size_t page = mem_pagesize();
+    size_t region_size = (size + ALIGNMENT + page - 1) & ~(page - 1);
+
+    if (region_size < size)
+    {
+        return NULL;
+    }
+    char *region = mem_mmap(region_size);
+    if (region == (void *) -1)
+    {
+        return NULL;
+    }
+
+    char *block_ptr = region + ALIGNMENT;
+    write_word(header(block_ptr), pack(region_size, 1 | MMAPPED));
+    zero_lo = block_ptr;
+    zero_hi = region + region_size;
+    return block_ptr;
+}
+
 /*
  * malloc
  */
@@ -521,6 +721,19 @@ void* malloc(size_t size)
 
     size_t adjusted_size;
 
+    // Give back what has stayed free for long enough
+    alloc_clock += size;
+    if (alloc_clock >= idle_check_at)
+    {
+        idle_check();
+    }
+
+    // Large requests get a region of their own
+    if (size >= MMAP_THRESHOLD)
+    {
+        return map_block(size);
+    }
+
     // Check for small sizes first and set to the minimum block size
     if (size <= ALIGNMENT)
     {
@@ -536,6 +749,7 @@ void* malloc(size_t size)
     }
 
     // Try to find a suitable block from the free list
+    last_size = adjusted_size;
     char* block_ptr = mem_block_size(adjusted_size);
     if (block_ptr)
     {
@@ -572,6 +786,13 @@ void free(void* ptr)
     // Retrieve the size of the block using the header
     size_t size = get_size(header(ptr));
 
+    // Large blocks go straight back to the system
+    if (get_mmapped(header(ptr)))
+    {
+        mem_munmap((char *)ptr - ALIGNMENT, size);
+        return;
+    }
+
     // Mark the block as free by writing the header and footer
     write_word(header(ptr), pack(size, 0));  // Set the header as free
     write_word(footer(ptr), pack(size, 0));  // Set the footer as free
@@ -583,6 +804,51 @@ void free(void* ptr)
     coalesce_mem(ptr);
 }
 
+/*
+ * mm_trim - Give the free block at the end of the heap back to the system,
+ * keeping at least pad bytes of it. Only whole pages are released, so that
+ * memlib can hand them back with madvise.
+ */
+bool mm_trim(size_t pad)
+{
+    // The epilogue header is the last word of the heap, and the last block's footer precedes it
+    char *epilogue = (char *)mem_heap_hi() + 1 - WORD_SIZE;
+    if (get_alloc(epilogue - WORD_SIZE))
+    {
+        return false;
+    }
+
+    size_t block_size = get_size(epilogue - WORD_SIZE);
+    void *block_ptr = epilogue + WORD_SIZE - block_size;
+
+    // Keep a whole free block of at least pad bytes, and release whole pages beyond it
+    size_t keep = smaller_blk_size(align(pad), 2 * ALIGNMENT);
+    if (block_size <= keep)
+    {
+        return false;
+    }
+    size_t release = (block_size - keep) & ~(mem_pagesize() - 1);
+    if (release == 0)
+    {
+        return false;
+    }
+
+    remove_from_tree(block_ptr);
+    if (mem_sbrk(-(intptr_t)release) == (void *) -1)
+    {
+        insert_to_tree(block_ptr, block_size);
+        return false;
+    }
+
+    // What is left becomes the last block, followed by a new epilogue
+    block_size -= release;
+    write_word(header(block_ptr), pack(block_size, 0));
+    write_word(footer(block_ptr), pack(block_size, 0));
+    write_word(header(next_block(block_ptr)), pack(0, 1));
+    insert_to_tree(block_ptr, block_size);
+    return true;
+}
+
 /*
  * The plan here is to create a list that we can use to traverse
  * between various points to make sure we can 
@@ -632,6 +898,12 @@ static void remove_from_tree(void *block_ptr)
  * Insert a block into the appropriate segregated free list
  */
 static void insert_to_tree(void *block_ptr, size_t block_size) {
+    // Large blocks remember when they were freed, for idle_check()
+    if (block_size >= PURGE_THRESHOLD)
+    {
+        *free_stamp(block_ptr) = alloc_clock;
+    }
+
     // Determine the appropriate list position based on block size
     int header_position = 0;
     while (block_size > 1 && header_position < MAX_LIST_POS) {
@@ -685,6 +957,26 @@ void* realloc(void* oldptr, size_t size)
         return NULL;
     }
 
+    // A large block that stays large is resized with mem_mremap(), which
+    // moves its pages rather than copying them if it cannot grow in place
+    if (get_mmapped(header(oldptr)) && size >= MMAP_THRESHOLD)
+    {
+        size_t page = mem_pagesize();
+        size_t region_size = (size + ALIGNMENT + page - 1) & ~(page - 1);
+        if (region_size < size)
+        {
+            return NULL;
+        }
+        char *region = mem_mremap((char *)oldptr - ALIGNMENT,
+                                  get_size(header(oldptr)), region_size);
+        if (region == (void *) -1)
+        {
+            return NULL;
+        }
+        write_word(region + WORD_SIZE, pack(region_size, 1 | MMAPPED));
+        return region + ALIGNMENT;
+    }
+
     // Allocate a new block with the requested size
     void* mem_ptr = malloc(size);
     if (!mem_ptr) 
@@ -693,7 +985,9 @@ void* realloc(void* oldptr, size_t size)
     }
 
     // Copy the old data to the new block
-    size_t prev_allocation_size = get_size(header(oldptr));  // Get the size of the old block
+    // The payload is the block less its header and footer, or less the header
+    // and padding of a region from mem_mmap
+    size_t prev_allocation_size = get_size(header(oldptr)) - 2 * WORD_SIZE;
     // Use the static min function for clarity
     size_t copy_size = bigger_blk_size(prev_allocation_size, size);
 
@@ -716,7 +1010,20 @@ void* calloc(size_t nmemb, size_t size)
     size *= nmemb;
     ptr = malloc(size);
     if (ptr) {
-        memset(ptr, 0, size);
+        // Only zero what lies outside the purged pages of the block
+        char *lo = zero_lo, *hi = zero_hi;
+        char *end = (char *)ptr + size;
+        if (lo == NULL || lo >= end || hi <= lo)
+        {
+            lo = end;
+            hi = end;
+        }
+        if (hi > end)
+        {
+            hi = end;
+        }
+        memset(ptr, 0, lo - (char *)ptr);
+        memset(hi, 0, end - hi);
     }
     return ptr;
 }
@@ -740,6 +1047,37 @@ static bool aligned(const void* p)
     return align(ip) == ip;
 }
 
+/*
+ * mm_heapstats - Walk every block between the prologue and the
+ * epilogue, and total up the free space for the driver.
+ */
+void mm_heapstats(mm_heapstats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    // The first real block follows the prologue
+    for (void *block_ptr = next_block(heap_list_ptr);
+         get_size(header(block_ptr)) > 0;
+         block_ptr = next_block(block_ptr))
+    {
+        size_t block_size = get_size(header(block_ptr));
+
+        if (get_alloc(header(block_ptr)))
+        {
+            stats->alloc_blocks++;
+            continue;
+        }
+
+        // Free block: count it, and keep track of the largest
+        stats->free_blocks++;
+        stats->free_bytes += block_size;
+        if (block_size > stats->largest_free)
+        {
+            stats->largest_free = block_size;
+        }
+    }
+}
+
 /*
  * mm_checkheap
  */
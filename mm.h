@@ -23,3 +23,18 @@ extern bool mm_init(void);
 
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int lineno);
+
+/* Summary of the free space in the heap, for the driver's utilization
+   timeline (-u) */
+typedef struct {
+    size_t free_bytes;      /* total size of all free blocks */
+    size_t largest_free;    /* size of the largest free block */
+    size_t free_blocks;     /* number of free blocks */
+    size_t alloc_blocks;    /* number of allocated blocks */
+} mm_heapstats_t;
+
+extern void mm_heapstats(mm_heapstats_t *stats);
+
+/* Give the free space at the end of the heap, beyond pad bytes, back to
+   the system.  Returns true if the heap shrank */
+extern bool mm_trim(size_t pad);
@@ -0,0 +1,127 @@
+/*
+ * Hardware performance counters.
+ *
+ * Each counter is opened as its own event, rather than as a group, so
+ * that one the PMU can't schedule doesn't take the others down with it.
+ * When there are more events than hardware counters, the kernel
+ * multiplexes them; counts are scaled by enabled/running time.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+const char *perf_counter_name[PC_NUM] = {
+    "cycles", "instrs", "L1D-miss", "LLC-miss", "dTLB-miss", "br-miss"
+};
+
+/* Event type and configuration for each counter */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} perf_events[PC_NUM] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                          | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+                          | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/* Layout of a read with TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING */
+typedef struct {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+} perf_reading_t;
+
+static int perf_event_open(struct perf_event_attr *attr)
+{
+    /* This thread, any CPU, no group, no flags */
+    return (int) syscall(SYS_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+int perf_open(perf_counters_t *pc, int verbose)
+{
+    int i;
+    int opened = 0;
+    int first_errno = 0;
+    for (i = 0; i < PC_NUM; i++) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = perf_events[i].type;
+	attr.config = perf_events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	pc->fd[i] = perf_event_open(&attr);
+	pc->count[i] = -1.0;
+	if (pc->fd[i] >= 0) {
+	    opened++;
+	} else {
+	    if (first_errno == 0)
+		first_errno = errno;
+	    if (verbose > 1)
+		fprintf(stderr, "Warning: Counter '%s' unavailable: %s\n",
+			perf_counter_name[i], strerror(errno));
+	}
+    }
+    if (opened == 0 && verbose) {
+	fprintf(stderr, "Warning: Could not open any performance counters: %s\n",
+		strerror(first_errno));
+	if (first_errno == EACCES || first_errno == EPERM)
+	    fprintf(stderr, "  Access may be restricted by /proc/sys/kernel/perf_event_paranoid\n");
+    }
+    return opened;
+}
+
+void perf_start(perf_counters_t *pc)
+{
+    int i;
+    for (i = 0; i < PC_NUM; i++) {
+	if (pc->fd[i] < 0)
+	    continue;
+	ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+	ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_stop(perf_counters_t *pc)
+{
+    int i;
+    for (i = 0; i < PC_NUM; i++) {
+	if (pc->fd[i] >= 0)
+	    ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+    for (i = 0; i < PC_NUM; i++) {
+	perf_reading_t r;
+	pc->count[i] = -1.0;
+	if (pc->fd[i] < 0)
+	    continue;
+	if (read(pc->fd[i], &r, sizeof(r)) != sizeof(r) || r.time_running == 0)
+	    continue;
+	pc->count[i] = (double) r.value * ((double) r.time_enabled / (double) r.time_running);
+    }
+}
+
+void perf_close(perf_counters_t *pc)
+{
+    int i;
+    for (i = 0; i < PC_NUM; i++) {
+	if (pc->fd[i] >= 0)
+	    close(pc->fd[i]);
+	pc->fd[i] = -1;
+    }
+}
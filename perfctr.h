@@ -0,0 +1,41 @@
+/*
+ * Hardware performance counters, read through perf_event_open(2).
+ *
+ * Counters measure the calling thread in user mode only.  Any counter
+ * the kernel or processor refuses is marked unavailable, rather than
+ * treated as an error, since perf access is often restricted.
+ */
+#include <stdbool.h>
+
+typedef enum {
+    PC_CYCLES,
+    PC_INSTRUCTIONS,
+    PC_L1D_MISSES,
+    PC_LLC_MISSES,
+    PC_DTLB_MISSES,
+    PC_BRANCH_MISSES,
+    PC_NUM
+} perf_counter_t;
+
+/* Short names for each counter, suitable for column headings */
+extern const char *perf_counter_name[PC_NUM];
+
+typedef struct {
+    int fd[PC_NUM];         /* file descriptor, or -1 if unavailable */
+    double count[PC_NUM];   /* counts from last perf_stop, scaled to
+                               account for multiplexing.  Negative if
+                               unavailable or never scheduled */
+} perf_counters_t;
+
+/* Open the counters.  Returns the number that could be opened.
+   If verbose, explains why any could not */
+int perf_open(perf_counters_t *pc, int verbose);
+
+/* Zero the counters and start counting */
+void perf_start(perf_counters_t *pc);
+
+/* Stop counting and read the counts into pc->count */
+void perf_stop(perf_counters_t *pc);
+
+/* Release the counters */
+void perf_close(perf_counters_t *pc);
@@ -0,0 +1,242 @@
+/*
+ * refmm.c - Reference allocator used to calibrate throughput targets.
+ *
+ * The driver runs this allocator on the same traces as mm.c, on the
+ * same simulated heap in memlib.c, and scores mm throughput relative
+ * to it.  Changing this file changes the benchmark, so BENCH_KEY in
+ * config.h must change with it.
+ *
+ * Blocks carry a one-word header and footer holding the block size
+ * and an allocated bit, with payloads aligned to REF_ALIGN.  Free
+ * blocks are kept in LIFO segregated lists, one per power of two,
+ * and coalesced immediately with their neighbors.  A request is
+ * served by the first fit in its own list, or else by the head of any
+ * larger list, or else by extending the heap.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memlib.h"
+#include "refmm.h"
+
+#define REF_ALIGN    16               /* payload alignment */
+#define REF_WSIZE    8                /* header and footer size */
+#define REF_MINBLOCK 32               /* header, two list links, footer */
+#define REF_CHUNK    4096             /* minimum heap extension */
+#define REF_LISTS    24               /* number of segregated lists */
+
+/* Free list links, overlaid on the payload of a free block */
+typedef struct ref_free_s {
+    struct ref_free_s *prev;
+    struct ref_free_s *next;
+} ref_free_t;
+
+static ref_free_t *ref_lists[REF_LISTS];
+static char *ref_first;               /* payload of the first real block */
+
+static size_t ref_pack(size_t size, bool alloc) {
+    return size | (alloc ? 1 : 0);
+}
+
+static size_t *ref_header(void *bp) {
+    return (size_t *) ((char *) bp - REF_WSIZE);
+}
+
+static size_t ref_size(void *bp) {
+    return *ref_header(bp) & ~(size_t) (REF_ALIGN - 1);
+}
+
+static bool ref_alloced(void *bp) {
+    return *ref_header(bp) & 1;
+}
+
+static size_t *ref_footer(void *bp) {
+    return (size_t *) ((char *) bp + ref_size(bp) - 2 * REF_WSIZE);
+}
+
+static void *ref_next(void *bp) {
+    return (char *) bp + ref_size(bp);
+}
+
+static void *ref_prev(void *bp) {
+    size_t prev_size = *(size_t *) ((char *) bp - 2 * REF_WSIZE) & ~(size_t) (REF_ALIGN - 1);
+    return (char *) bp - prev_size;
+}
+
+static void ref_set(void *bp, size_t size, bool alloc) {
+    *ref_header(bp) = ref_pack(size, alloc);
+    *ref_footer(bp) = ref_pack(size, alloc);
+}
+
+/* List holding free blocks of the given size: floor(log2(size)) - 5 */
+static int ref_list_index(size_t size) {
+    int idx = 63 - __builtin_clzll(size) - 5;
+    if (idx < 0)
+        idx = 0;
+    if (idx >= REF_LISTS)
+        idx = REF_LISTS - 1;
+    return idx;
+}
+
+static void ref_insert(void *bp) {
+    ref_free_t *node = (ref_free_t *) bp;
+    int idx = ref_list_index(ref_size(bp));
+    node->prev = NULL;
+    node->next = ref_lists[idx];
+    if (ref_lists[idx])
+        ref_lists[idx]->prev = node;
+    ref_lists[idx] = node;
+}
+
+static void ref_remove(void *bp) {
+    ref_free_t *node = (ref_free_t *) bp;
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        ref_lists[ref_list_index(ref_size(bp))] = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+}
+
+/* Merge a free block, not on any list, with its free neighbors */
+static void *ref_coalesce(void *bp) {
+    size_t size = ref_size(bp);
+    void *next = ref_next(bp);
+    if (!ref_alloced(next)) {
+        ref_remove(next);
+        size += ref_size(next);
+    }
+    if ((char *) bp > ref_first && !ref_alloced(ref_prev(bp))) {
+        bp = ref_prev(bp);
+        ref_remove(bp);
+        size += ref_size(bp);
+    }
+    ref_set(bp, size, false);
+    ref_insert(bp);
+    return bp;
+}
+
+/* Grow the heap by at least size bytes, returning the new free block */
+static void *ref_extend(size_t size) {
+    char *bp;
+    if (size < REF_CHUNK)
+        size = REF_CHUNK;
+    if ((bp = mem_sbrk(size)) == (void *) -1)
+        return NULL;
+    /* The new block starts at the old epilogue */
+    ref_set(bp, size, false);
+    *ref_header(ref_next(bp)) = ref_pack(0, true);
+    return ref_coalesce(bp);
+}
+
+static size_t ref_adjust(size_t size) {
+    size_t asize = (size + REF_WSIZE * 2 + REF_ALIGN - 1) & ~(size_t) (REF_ALIGN - 1);
+    return asize < REF_MINBLOCK ? REF_MINBLOCK : asize;
+}
+
+static void *ref_find_fit(size_t asize) {
+    int idx = ref_list_index(asize);
+    ref_free_t *node;
+    for (node = ref_lists[idx]; node != NULL; node = node->next) {
+        if (ref_size(node) >= asize)
+            return node;
+    }
+    for (idx++; idx < REF_LISTS; idx++) {
+        if (ref_lists[idx])
+            return ref_lists[idx];
+    }
+    return NULL;
+}
+
+/* Allocate asize bytes at the start of free block bp, splitting it */
+static void ref_place(void *bp, size_t asize) {
+    size_t size = ref_size(bp);
+    ref_remove(bp);
+    if (size - asize >= REF_MINBLOCK) {
+        void *rest;
+        ref_set(bp, asize, true);
+        rest = ref_next(bp);
+        ref_set(rest, size - asize, false);
+        ref_insert(rest);
+    } else {
+        ref_set(bp, size, true);
+    }
+}
+
+bool ref_init(void) {
+    size_t *start;
+    int i;
+    for (i = 0; i < REF_LISTS; i++)
+        ref_lists[i] = NULL;
+    /* Padding, prologue header and footer, epilogue header */
+    if ((start = mem_sbrk(4 * REF_WSIZE)) == (void *) -1)
+        return false;
+    start[0] = 0;
+    start[1] = ref_pack(REF_ALIGN, true);
+    start[2] = ref_pack(REF_ALIGN, true);
+    start[3] = ref_pack(0, true);
+    ref_first = (char *) &start[4];
+    return true;
+}
+
+void *ref_malloc(size_t size) {
+    size_t asize;
+    void *bp;
+    if (size == 0)
+        return NULL;
+    asize = ref_adjust(size);
+    if ((bp = ref_find_fit(asize)) == NULL &&
+        (bp = ref_extend(asize)) == NULL)
+        return NULL;
+    ref_place(bp, asize);
+    return bp;
+}
+
+void ref_free(void *ptr) {
+    if (ptr == NULL)
+        return;
+    ref_set(ptr, ref_size(ptr), false);
+    ref_coalesce(ptr);
+}
+
+void *ref_realloc(void *ptr, size_t size) {
+    size_t asize, size_now;
+    void *next, *newptr;
+
+    if (ptr == NULL)
+        return ref_malloc(size);
+    if (size == 0) {
+        ref_free(ptr);
+        return NULL;
+    }
+
+    asize = ref_adjust(size);
+    size_now = ref_size(ptr);
+    if (asize <= size_now)
+        return ptr;
+
+    /* Grow into a free successor when it is big enough */
+    next = ref_next(ptr);
+    if (!ref_alloced(next) && size_now + ref_size(next) >= asize) {
+        size_t total = size_now + ref_size(next);
+        ref_remove(next);
+        if (total - asize >= REF_MINBLOCK) {
+            void *rest;
+            ref_set(ptr, asize, true);
+            rest = ref_next(ptr);
+            ref_set(rest, total - asize, false);
+            ref_insert(rest);
+        } else {
+            ref_set(ptr, total, true);
+        }
+        return ptr;
+    }
+
+    if ((newptr = ref_malloc(size)) == NULL)
+        return NULL;
+    mem_memcpy(newptr, ptr, size_now - 2 * REF_WSIZE);
+    ref_free(ptr);
+    return newptr;
+}
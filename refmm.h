@@ -0,0 +1,11 @@
+/*
+ * Reference allocator, compiled into the driver.  Its throughput on
+ * the default traces sets the throughput targets for mm.c.
+ */
+#include <stddef.h>
+#include <stdbool.h>
+
+extern bool ref_init(void);
+extern void *ref_malloc(size_t size);
+extern void ref_free(void *ptr);
+extern void *ref_realloc(void *ptr, size_t size);
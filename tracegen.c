@@ -0,0 +1,643 @@
+/*
+ * tracegen.c - Generate large synthetic .rep traces
+ *
+ * Each allocation draws a size from a size distribution and a lifetime
+ * from a lifetime distribution.  At every step the generator frees any
+ * block whose lifetime has run out, and otherwise allocates a new
+ * block, or with some probability reallocates a random live block to
+ * a larger size.  Once the requested number of operations is nearly
+ * reached, the remaining live blocks are freed in order of death, so
+ * every trace ends with an empty heap.
+ *
+ * Distributions are given as name:param:param..., e.g.
+ *
+ *   Sizes:      power:<min>:<max>:<alpha>   truncated power law
+ *               uniform:<min>:<max>
+ *               bimodal:<small>:<large>:<p_small>
+ *               hist:<file>                 lines of "<size> <weight>"
+ *   Lifetimes:  exp:<mean>                  in operations
+ *               power:<min>:<max>:<alpha>
+ *               uniform:<min>:<max>
+ *               fixed:<ops>
+ *
+ * With -L, lifetimes are rescaled so that about that many blocks are
+ * live in the steady state.
+ *
+ * Alternatively, -p generates one of several adversarial patterns,
+ * each aimed at a weakness of segregated-fit allocators like mm.c:
+ *
+ *   pin       alternating small and large blocks; freeing the large
+ *             ones leaves holes that the small ones keep from
+ *             coalescing, and the next requests are slightly larger
+ *   sawtooth  the live set repeatedly ramps up and collapses, with
+ *             each ramp using sizes too large for the holes left behind
+ *   chunk     frees all but one block in every heap extension (-x,
+ *             mm.c's HEAP_EXTENSION), then asks for blocks larger
+ *             than an extension
+ *   pingpong  blocks that take turns growing by realloc, each followed
+ *             by a small allocation, so none can grow in place
+ *
+ * The trace body is written to a temporary file first, since the
+ * header needs totals known only at the end.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define MAXLINE      1024
+#define MAXPARAMS    3
+#define MAXBLOCK     (1L << 30)   /* largest block a realloc may grow to */
+#define MEAN_SAMPLES 100000       /* draws used to estimate a mean */
+#define CHUNK_SIZE   4096         /* default heap extension for "chunk" */
+
+typedef enum { D_POWER, D_UNIFORM, D_BIMODAL, D_HIST, D_EXP, D_FIXED } dist_kind_t;
+
+typedef struct {
+    dist_kind_t kind;
+    double param[MAXPARAMS];
+    int nhist;                    /* D_HIST: number of entries */
+    double *hist_value;           /* ... their values */
+    double *hist_cum;             /* ... and cumulative weights */
+} dist_t;
+
+/* A live block, kept in a min-heap ordered by time of death */
+typedef struct {
+    uint64_t death;
+    long id;
+    long size;
+} block_t;
+
+static block_t *live;
+static long num_live = 0;
+static long max_live = 0;
+
+/* The trace body, and the totals for its header */
+static FILE *body;
+static long num_ids = 0;
+static long num_ops = 0;
+static long live_bytes = 0;
+static long max_bytes = 0;
+
+static uint64_t rng_state = 0x2545F4914F6CDD1Dull;
+
+/* xorshift64* */
+static uint64_t rand64(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+/* Uniform on [0, 1) */
+static double urand(void) {
+    return (rand64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void app_error(const char *msg, const char *arg) {
+    fprintf(stderr, "tracegen: %s%s\n", msg, arg);
+    exit(1);
+}
+
+/*
+ * read_hist - Read an empirical distribution, one "<value> <weight>"
+ *     pair per line.  Blank lines and lines starting with # are skipped.
+ */
+static void read_hist(dist_t *d, const char *file) {
+    char buf[MAXLINE];
+    double value, weight, total = 0;
+    int alloced = 0;
+    FILE *f = fopen(file, "r");
+
+    if (f == NULL)
+        app_error("Could not open histogram file ", file);
+    d->nhist = 0;
+    d->hist_value = d->hist_cum = NULL;
+    while (fgets(buf, MAXLINE, f) != NULL) {
+        if (buf[0] == '#' || sscanf(buf, "%lf %lf", &value, &weight) != 2)
+            continue;
+        if (value < 1 || weight < 0)
+            app_error("Bad histogram line: ", buf);
+        if (d->nhist == alloced) {
+            alloced = alloced ? 2 * alloced : 64;
+            d->hist_value = realloc(d->hist_value, alloced * sizeof(double));
+            d->hist_cum = realloc(d->hist_cum, alloced * sizeof(double));
+            if (!d->hist_value || !d->hist_cum)
+                app_error("Out of memory reading ", file);
+        }
+        total += weight;
+        d->hist_value[d->nhist] = value;
+        d->hist_cum[d->nhist] = total;
+        d->nhist++;
+    }
+    fclose(f);
+    if (d->nhist == 0 || total <= 0)
+        app_error("No entries in histogram file ", file);
+}
+
+/*
+ * parse_dist - Parse a distribution spec.  Sizes and lifetimes accept
+ *     different kinds, as listed at the top of the file.
+ */
+static void parse_dist(dist_t *d, const char *spec, bool lifetime) {
+    static const struct {
+        const char *name;
+        dist_kind_t kind;
+        int nparams;
+        bool size_ok, life_ok;
+    } kinds[] = {
+        { "power",   D_POWER,   3, true,  true },
+        { "uniform", D_UNIFORM, 2, true,  true },
+        { "bimodal", D_BIMODAL, 3, true,  false },
+        { "hist",    D_HIST,    0, true,  false },
+        { "exp",     D_EXP,     1, false, true },
+        { "fixed",   D_FIXED,   1, false, true },
+    };
+    char buf[MAXLINE];
+    char *name, *arg;
+    size_t k;
+    int i;
+
+    snprintf(buf, MAXLINE, "%s", spec);
+    name = strtok(buf, ":");
+    for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        if (name && strcmp(name, kinds[k].name) == 0 &&
+            (lifetime ? kinds[k].life_ok : kinds[k].size_ok))
+            break;
+    }
+    if (k == sizeof(kinds) / sizeof(kinds[0]))
+        app_error(lifetime ? "Unknown lifetime distribution: "
+                  : "Unknown size distribution: ", spec);
+    d->kind = kinds[k].kind;
+
+    if (d->kind == D_HIST) {
+        if ((arg = strtok(NULL, "")) == NULL)
+            app_error("Missing histogram file in ", spec);
+        read_hist(d, arg);
+        return;
+    }
+    for (i = 0; i < kinds[k].nparams; i++) {
+        if ((arg = strtok(NULL, ":")) == NULL)
+            app_error("Too few parameters in ", spec);
+        d->param[i] = atof(arg);
+    }
+    if (strtok(NULL, ":") != NULL)
+        app_error("Too many parameters in ", spec);
+
+    switch (d->kind) {
+    case D_POWER:
+    case D_UNIFORM:
+        if (d->param[0] < 1 || d->param[1] < d->param[0])
+            app_error("Need 1 <= min <= max in ", spec);
+        break;
+    case D_BIMODAL:
+        if (d->param[0] < 1 || d->param[1] < 1 || d->param[2] < 0 || d->param[2] > 1)
+            app_error("Need sizes >= 1 and 0 <= p <= 1 in ", spec);
+        break;
+    default:
+        if (d->param[0] <= 0)
+            app_error("Need a positive parameter in ", spec);
+        break;
+    }
+}
+
+/* Draw a value >= 1 from a distribution */
+static double sample(const dist_t *d) {
+    double u = urand();
+    double lo = d->param[0], hi = d->param[1], a = d->param[2];
+
+    switch (d->kind) {
+    case D_POWER:
+        /* Inverse CDF of a density proportional to x^-a on [lo, hi] */
+        if (fabs(a - 1.0) < 1e-9)
+            return lo * pow(hi / lo, u);
+        return pow(pow(lo, 1 - a) + u * (pow(hi, 1 - a) - pow(lo, 1 - a)), 1 / (1 - a));
+    case D_UNIFORM:
+        return lo + u * (hi - lo + 1);
+    case D_BIMODAL:
+        return u < a ? lo : hi;
+    case D_HIST: {
+        /* Binary search for the first cumulative weight above u */
+        double target = u * d->hist_cum[d->nhist - 1];
+        int left = 0, right = d->nhist - 1;
+        while (left < right) {
+            int mid = (left + right) / 2;
+            if (d->hist_cum[mid] > target)
+                right = mid;
+            else
+                left = mid + 1;
+        }
+        return d->hist_value[left];
+    }
+    case D_EXP:
+        return 1 - lo * log(1 - u);
+    case D_FIXED:
+        return lo;
+    }
+    return 1;
+}
+
+static double mean_of(const dist_t *d) {
+    double sum = 0;
+    int i;
+    for (i = 0; i < MEAN_SAMPLES; i++)
+        sum += sample(d);
+    return sum / MEAN_SAMPLES;
+}
+
+/* Min-heap of live blocks */
+
+static void heap_swap(long i, long j) {
+    block_t temp = live[i];
+    live[i] = live[j];
+    live[j] = temp;
+}
+
+static void heap_push(block_t b) {
+    long i;
+    if (num_live == max_live) {
+        max_live = max_live ? 2 * max_live : 1024;
+        if ((live = realloc(live, max_live * sizeof(block_t))) == NULL)
+            app_error("Out of memory for live blocks", "");
+    }
+    i = num_live++;
+    live[i] = b;
+    while (i > 0 && live[(i - 1) / 2].death > live[i].death) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static block_t heap_pop(void) {
+    block_t top = live[0];
+    long i = 0;
+    live[0] = live[--num_live];
+    while (1) {
+        long child = 2 * i + 1;
+        if (child >= num_live)
+            break;
+        if (child + 1 < num_live && live[child + 1].death < live[child].death)
+            child++;
+        if (live[i].death <= live[child].death)
+            break;
+        heap_swap(i, child);
+        i = child;
+    }
+    return top;
+}
+
+/* Write requests to the trace body, keeping the totals */
+
+static long emit_alloc(long size) {
+    fprintf(body, "a %ld %ld\n", num_ids, size);
+    num_ops++;
+    live_bytes += size;
+    if (live_bytes > max_bytes)
+        max_bytes = live_bytes;
+    return num_ids++;
+}
+
+static void emit_realloc(long id, long old_size, long size) {
+    fprintf(body, "r %ld %ld\n", id, size);
+    num_ops++;
+    live_bytes += size - old_size;
+    if (live_bytes > max_bytes)
+        max_bytes = live_bytes;
+}
+
+static void emit_free(long id, long size) {
+    fprintf(body, "f %ld\n", id);
+    num_ops++;
+    live_bytes -= size;
+}
+
+/*
+ * gen_random - Draw sizes and lifetimes from the distributions until
+ *     about target_ops requests have been made
+ */
+static void gen_random(long target_ops, const dist_t *sizes, const dist_t *lifetimes,
+                       double life_scale, double realloc_prob, double growth) {
+    uint64_t t;
+
+    for (t = 0; num_ops + num_live < target_ops; t++) {
+        if (num_live > 0 && live[0].death <= t) {
+            block_t b = heap_pop();
+            emit_free(b.id, b.size);
+        } else if (num_live > 0 && urand() < realloc_prob) {
+            block_t *b = &live[rand64() % num_live];
+            long size = (long) ceil(b->size * growth);
+            if (size > MAXBLOCK)
+                size = MAXBLOCK;
+            emit_realloc(b->id, b->size, size);
+            b->size = size;
+        } else {
+            block_t b;
+            b.size = (long) sample(sizes);
+            b.id = emit_alloc(b.size);
+            b.death = t + (uint64_t) ceil(sample(lifetimes) * life_scale);
+            heap_push(b);
+        }
+    }
+
+    /* Free what is left, in order of death */
+    while (num_live > 0) {
+        block_t b = heap_pop();
+        emit_free(b.id, b.size);
+    }
+}
+
+/*
+ * Adversarial patterns.  Blocks are tracked in the live array in
+ * allocation order, with death unused.  Each pattern works in epochs
+ * that end by freeing everything, so that the next epoch starts from
+ * a fully coalesced heap and lays out its blocks contiguously.
+ */
+
+#define ROUND_BYTES (256 * 1024)  /* bytes allocated per round */
+#define PIN_SIZE    16            /* size of blocks that pin holes */
+
+static void track(long size) {
+    block_t b;
+    b.size = size;
+    b.id = emit_alloc(size);
+    b.death = 0;
+    if (num_live == max_live) {
+        max_live = max_live ? 2 * max_live : 1024;
+        if ((live = realloc(live, max_live * sizeof(block_t))) == NULL)
+            app_error("Out of memory for live blocks", "");
+    }
+    live[num_live++] = b;
+}
+
+/*
+ * thin - Free the tracked blocks from index from on, except every
+ *     period'th one, starting with the first.  A period of 0 frees
+ *     them all.
+ */
+static void thin(long from, long period) {
+    long i, kept = from;
+    for (i = from; i < num_live; i++) {
+        if (period > 0 && (i - from) % period == 0)
+            live[kept++] = live[i];
+        else
+            emit_free(live[i].id, live[i].size);
+    }
+    num_live = kept;
+}
+
+/*
+ * pin: pairs of a small and a large block.  Freeing the large ones
+ * leaves holes that the small ones keep apart, and the next requests
+ * are each slightly too large for a hole, so the heap doubles.
+ */
+static void gen_pin(long target_ops) {
+    long large = 64;
+    long pairs, i;
+    while (1) {
+        pairs = ROUND_BYTES / large;
+        if (num_ops + 5 * pairs > target_ops)
+            break;
+        for (i = 0; i < pairs; i++) {
+            track(PIN_SIZE);
+            track(large);
+        }
+        thin(0, 2);
+        for (i = 0; i < pairs; i++)
+            track(large + 16);
+        thin(0, 0);
+        large = large < 4096 ? 2 * large : 64;
+    }
+}
+
+/*
+ * sawtooth: each ramp allocates blocks of one size, then the live set
+ * collapses to every fourth block.  Blocks of the next ramp are too
+ * large for the three-block holes, so every ramp grows the heap.
+ */
+static void gen_sawtooth(long target_ops) {
+    long size = 32;
+    long from = 0;
+    long n, i;
+    while (1) {
+        n = ROUND_BYTES / size;
+        if (num_ops + num_live + 2 * n > target_ops)
+            break;
+        from = num_live;
+        for (i = 0; i < n; i++)
+            track(size);
+        thin(from, 4);
+        /* Three blocks and their headers and footers, plus a bit */
+        size = 3 * size + 64;
+        if (size > 65536) {
+            thin(0, 0);
+            size = 32;
+        }
+    }
+    thin(0, 0);
+}
+
+/*
+ * chunk: small blocks fill the free space, and all but one in each
+ * heap extension are freed.  Blocks larger than an extension then
+ * can't use any of it.  They are freed at the end of the round, and
+ * the next round's small blocks pin that space in turn.
+ */
+static void gen_chunk(long target_ops, long chunk) {
+    long small = 32;
+    long large = chunk + chunk / 2;
+    long nsmall, nlarge, per_chunk, from, i;
+    while (1) {
+        nsmall = ROUND_BYTES / small;
+        nlarge = ROUND_BYTES / large + 1;
+        if (num_ops + num_live + 2 * (nsmall + nlarge) > target_ops)
+            break;
+        /* Account for a header and footer per block */
+        per_chunk = chunk / (small + 16);
+        from = num_live;
+        for (i = 0; i < nsmall; i++)
+            track(small);
+        thin(from, per_chunk > 1 ? per_chunk : 1);
+        from = num_live;
+        for (i = 0; i < nlarge; i++)
+            track(large);
+        thin(from, 0);
+        small = small < 256 ? small + 16 : 32;
+    }
+    thin(0, 0);
+}
+
+/*
+ * pingpong: blocks take turns growing by realloc.  A small fence is
+ * allocated after each move, landing next to the moved block, so no
+ * block can later grow in place, and each vacated spot is slightly too
+ * small for the next request.
+ */
+#define PLAYERS  8
+#define PONG_MAX (256 * 1024)     /* restart the game at this size */
+
+static void gen_pingpong(long target_ops) {
+    long size[PLAYERS], id[PLAYERS];
+    int p;
+
+    for (p = 0; p < PLAYERS; p++) {
+        size[p] = 64;
+        id[p] = emit_alloc(size[p]);
+    }
+    while (num_ops + num_live + 2 * PLAYERS + PLAYERS < target_ops) {
+        for (p = 0; p < PLAYERS; p++) {
+            long grown = size[p] + size[p] / 4 + 16;
+            if (grown > PONG_MAX) {
+                /* Start over by shrinking the block back; the fences stay
+                   until the last player starts over, below */
+                grown = 64;
+            }
+            emit_realloc(id[p], size[p], grown);
+            size[p] = grown;
+            track(PIN_SIZE);
+        }
+        if (size[PLAYERS - 1] == 64)
+            thin(0, 0);
+    }
+    for (p = 0; p < PLAYERS; p++)
+        emit_free(id[p], size[p]);
+    thin(0, 0);
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-h] [-n <ops>] [-s <sizes>] [-l <lifetimes>] [-L <blocks>]\n", prog);
+    fprintf(stderr, "       [-p <pattern> [-x <bytes>]]\n");
+    fprintf(stderr, "       [-r <prob>] [-g <factor>] [-w <weight>] [-S <seed>] [-o <file>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-n <ops>        Approximate number of operations (default 1000000)\n");
+    fprintf(stderr, "\t-s <dist>       Size distribution (default power:16:4096:1.5)\n");
+    fprintf(stderr, "\t-l <dist>       Lifetime distribution in ops (default exp:1000)\n");
+    fprintf(stderr, "\t-L <blocks>     Rescale lifetimes for about <blocks> live blocks\n");
+    fprintf(stderr, "\t-r <prob>       Probability that a step reallocates a live block (default 0)\n");
+    fprintf(stderr, "\t-g <factor>     Growth factor of each realloc (default 1.5)\n");
+    fprintf(stderr, "\t-w <weight>     Trace weight in the header (default 1)\n");
+    fprintf(stderr, "\t-S <seed>       Random seed\n");
+    fprintf(stderr, "\t-o <file>       Output file (default stdout)\n");
+    fprintf(stderr, "\t-p <pattern>    Adversarial pattern: pin, sawtooth, chunk or pingpong\n");
+    fprintf(stderr, "\t-x <bytes>      Heap extension size for the chunk pattern (default %d)\n",
+            CHUNK_SIZE);
+    fprintf(stderr, "\t-h              Print this message\n");
+    fprintf(stderr, "Sizes: power:<min>:<max>:<alpha> uniform:<min>:<max>\n");
+    fprintf(stderr, "       bimodal:<small>:<large>:<p_small> hist:<file>\n");
+    fprintf(stderr, "Lifetimes: exp:<mean> power:<min>:<max>:<alpha> uniform:<min>:<max> fixed:<ops>\n");
+}
+
+int main(int argc, char **argv) {
+    dist_t sizes, lifetimes;
+    char *size_spec = "power:16:4096:1.5";
+    char *life_spec = "exp:1000";
+    char *outname = NULL;
+    long target_ops = 1000000;
+    long target_live = 0;
+    double realloc_prob = 0.0;
+    double growth = 1.5;
+    int weight = 1;
+    double life_scale = 1.0;
+    char *pattern = NULL;
+    long chunk = CHUNK_SIZE;
+    FILE *out;
+    char buf[1 << 16];
+    size_t n;
+    int c;
+
+    while ((c = getopt(argc, argv, "hn:s:l:L:r:g:w:S:o:p:x:")) != -1) {
+        switch (c) {
+        case 'n':
+            target_ops = atol(optarg);
+            break;
+        case 's':
+            size_spec = optarg;
+            break;
+        case 'l':
+            life_spec = optarg;
+            break;
+        case 'L':
+            target_live = atol(optarg);
+            break;
+        case 'r':
+            realloc_prob = atof(optarg);
+            break;
+        case 'g':
+            growth = atof(optarg);
+            break;
+        case 'w':
+            weight = atoi(optarg);
+            break;
+        case 'S':
+            rng_state = strtoull(optarg, NULL, 0) * 0x9E3779B97F4A7C15ull + 1;
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        case 'p':
+            pattern = optarg;
+            break;
+        case 'x':
+            chunk = atol(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (target_ops < 2)
+        app_error("Need at least 2 operations", "");
+    if (weight < 0 || weight > 3)
+        app_error("Weight must be in {0, 1, 2, 3}", "");
+    if (realloc_prob < 0 || realloc_prob >= 1 || growth < 1)
+        app_error("Need 0 <= realloc probability < 1 and growth factor >= 1", "");
+
+    parse_dist(&sizes, size_spec, false);
+    parse_dist(&lifetimes, life_spec, true);
+
+    /*
+     * In the steady state, half the steps allocate and half free, so
+     * the live set is about half the mean lifetime
+     */
+    if (target_live > 0)
+        life_scale = 2.0 * target_live / mean_of(&lifetimes);
+
+    if ((body = tmpfile()) == NULL)
+        app_error("Could not create temporary file", "");
+
+    if (pattern == NULL)
+        gen_random(target_ops, &sizes, &lifetimes, life_scale, realloc_prob, growth);
+    else if (strcmp(pattern, "pin") == 0)
+        gen_pin(target_ops);
+    else if (strcmp(pattern, "sawtooth") == 0)
+        gen_sawtooth(target_ops);
+    else if (strcmp(pattern, "chunk") == 0)
+        gen_chunk(target_ops, chunk);
+    else if (strcmp(pattern, "pingpong") == 0)
+        gen_pingpong(target_ops);
+    else
+        app_error("Unknown pattern: ", pattern);
+
+    if (outname == NULL)
+        out = stdout;
+    else if ((out = fopen(outname, "w")) == NULL)
+        app_error("Could not open ", outname);
+    fprintf(out, "%d\n%ld\n%ld\n%ld\n", weight, num_ids, num_ops, max_bytes);
+    rewind(body);
+    while ((n = fread(buf, 1, sizeof(buf), body)) > 0) {
+        if (fwrite(buf, 1, n, out) != n)
+            app_error("Could not write trace", "");
+    }
+    fclose(body);
+    if (out != stdout && fclose(out) != 0)
+        app_error("Could not write ", outname);
+
+    fprintf(stderr, "tracegen: %ld ops, %ld ids, peak %ld bytes live\n",
+            num_ops, num_ids, max_bytes);
+    return 0;
+}
@@ -0,0 +1,352 @@
+/*
+ * traceinfo.c - Profile the workload in .rep traces
+ *
+ * Reports, for each trace:
+ *   - the distribution of request sizes for each kind of request
+ *   - the lifetimes of blocks, in requests between allocation and free
+ *   - realloc chains: how often blocks are reallocated, and how much
+ *     they grow or shrink over a chain
+ *   - a timeline of live bytes and blocks, with their peaks
+ *   - size-class boundaries that split the smallest N% of requests
+ *     into classes of equal frequency
+ *
+ * Requests are streamed rather than stored, so memory use depends only
+ * on the number of ids, and arbitrarily long traces can be profiled.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hist.h"
+
+#define MAXLINE     1024
+#define ALIGNMENT   16            /* size classes are rounded to this */
+#define LOG_BUCKETS 48            /* power-of-two size buckets */
+
+enum { OP_ALLOC, OP_REALLOC, OP_FREE, OP_TYPES };
+static const char *op_name[OP_TYPES] = { "malloc", "realloc", "free" };
+
+/* What we know about each id while it is live */
+typedef struct {
+    size_t size;                  /* current size; 0 if not live */
+    size_t first_size;            /* size when allocated */
+    uint64_t born;                /* request index of the allocation */
+    uint32_t reallocs;            /* length of its realloc chain */
+    bool live;
+} id_info_t;
+
+/* Options */
+static int num_classes = 10;
+static double coverage = 95.0;
+static int timeline_points = 20;
+
+static void app_error(const char *msg, const char *arg) {
+    fprintf(stderr, "traceinfo: %s%s\n", msg, arg);
+    exit(1);
+}
+
+static int log2_bucket(size_t v) {
+    int b = v == 0 ? 0 : 63 - __builtin_clzll(v);
+    return b < LOG_BUCKETS ? b : LOG_BUCKETS - 1;
+}
+
+static void print_hist_line(const char *name, const hist_t *h) {
+    if (h->count == 0) {
+        printf("  %-10s %10s\n", name, "none");
+        return;
+    }
+    printf("  %-10s %10lu %10.1f %8lu %8lu %8lu %8lu %10lu %10lu\n", name,
+           (unsigned long) h->count, hist_mean(h),
+           (unsigned long) h->min,
+           (unsigned long) hist_percentile(h, 50),
+           (unsigned long) hist_percentile(h, 90),
+           (unsigned long) hist_percentile(h, 99),
+           (unsigned long) hist_percentile(h, 99.9),
+           (unsigned long) h->max);
+}
+
+static void print_hist_header(const char *what) {
+    printf("  %-10s %10s %10s %8s %8s %8s %8s %10s %10s\n", what,
+           "count", "mean", "min", "p50", "p90", "p99", "p99.9", "max");
+}
+
+/*
+ * print_classes - Propose num_classes boundaries splitting the smallest
+ *     coverage percent of requests into classes of equal frequency.
+ *     Larger requests fall into a final, open-ended class.
+ */
+static void print_classes(const hist_t *req) {
+    size_t last = 0;
+    int i;
+    printf("\nSize classes covering %.1f%% of requests in %d classes of about %.1f%% each:\n",
+           coverage, num_classes, coverage / num_classes);
+    printf("  %8s  %8s  %s\n", "class", "<=bytes", "cumulative");
+    for (i = 1; i <= num_classes; i++) {
+        double pct = coverage * i / num_classes;
+        size_t bound = hist_percentile(req, pct);
+        bound = (bound + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        if (bound < ALIGNMENT)
+            bound = ALIGNMENT;
+        /* Classes too close together in size are merged */
+        if (bound <= last)
+            continue;
+        printf("  %8d  %8zu  %9.1f%%\n", i, bound, pct);
+        last = bound;
+    }
+    printf("  %8s  %8s  %9.1f%%\n", "rest", "-", 100.0);
+}
+
+static void profile(const char *filename) {
+    FILE *f;
+    char buf[MAXLINE];
+    long weight, num_ids, num_ops, max_alloc;
+    id_info_t *ids;
+    hist_t *sizes, *lifetimes, *chains, *requests;
+    uint64_t log_counts[OP_TYPES][LOG_BUCKETS];
+    uint64_t op = 0, never_freed = 0;
+    uint64_t grew = 0, shrank = 0, same = 0, chained = 0;
+    double growth_sum = 0;
+    size_t live_bytes = 0, peak_bytes = 0;
+    long live_blocks = 0, peak_blocks = 0;
+    uint64_t peak_bytes_op = 0, peak_blocks_op = 0;
+    uint64_t window;
+    size_t window_bytes = 0;
+    long window_blocks = 0;
+    int t, b;
+    long i;
+
+    if ((f = fopen(filename, "r")) == NULL)
+        app_error("Could not open ", filename);
+    if (fscanf(f, "%ld %ld %ld %ld", &weight, &num_ids, &num_ops, &max_alloc) != 4)
+        app_error("Bad header in ", filename);
+    if (num_ids < 0 || num_ops < 0)
+        app_error("Bad header in ", filename);
+
+    ids = calloc(num_ids > 0 ? num_ids : 1, sizeof(id_info_t));
+    sizes = malloc(OP_TYPES * sizeof(hist_t));
+    lifetimes = malloc(sizeof(hist_t));
+    chains = malloc(sizeof(hist_t));
+    requests = malloc(sizeof(hist_t));
+    if (!ids || !sizes || !lifetimes || !chains || !requests)
+        app_error("Out of memory for ", filename);
+    for (t = 0; t < OP_TYPES; t++)
+        hist_init(&sizes[t]);
+    hist_init(lifetimes);
+    hist_init(chains);
+    hist_init(requests);
+    memset(log_counts, 0, sizeof(log_counts));
+
+    printf("%s: weight %ld, %ld ids, %ld requests, max_alloc %ld\n",
+           filename, weight, num_ids, num_ops, max_alloc);
+    window = num_ops / timeline_points;
+    if (window == 0)
+        window = 1;
+    printf("\nTimeline (peaks within each window of %lu requests):\n",
+           (unsigned long) window);
+    printf("  %12s %14s %12s\n", "requests", "live bytes", "live blocks");
+
+    /* Skip the rest of the header line */
+    if (fgets(buf, MAXLINE, f) == NULL)
+        buf[0] = 0;
+    while (fgets(buf, MAXLINE, f) != NULL) {
+        char type;
+        long id;
+        size_t size = 0;
+        id_info_t *info;
+        int n = sscanf(buf, " %c %ld %zu", &type, &id, &size);
+
+        if (n < 1)
+            continue;
+        if (n < 2 || (type != 'f' && n < 3))
+            app_error("Bad request: ", buf);
+        if (id >= num_ids)
+            app_error("Id beyond num_ids in request: ", buf);
+        info = id >= 0 ? &ids[id] : NULL;
+
+        switch (type) {
+        case 'a':
+            if (info == NULL)
+                app_error("Negative id in request: ", buf);
+            hist_record(&sizes[OP_ALLOC], size);
+            hist_record(requests, size);
+            log_counts[OP_ALLOC][log2_bucket(size)]++;
+            info->size = info->first_size = size;
+            info->born = op;
+            info->reallocs = 0;
+            info->live = true;
+            live_bytes += size;
+            live_blocks++;
+            break;
+        case 'r':
+            if (info == NULL)
+                app_error("Negative id in request: ", buf);
+            hist_record(&sizes[OP_REALLOC], size);
+            hist_record(requests, size);
+            log_counts[OP_REALLOC][log2_bucket(size)]++;
+            if (!info->live) {
+                /* realloc(NULL, size) allocates */
+                info->first_size = 0;
+                info->born = op;
+                info->reallocs = 0;
+                info->live = true;
+                info->size = 0;
+                live_blocks++;
+            }
+            if (size > info->size)
+                grew++;
+            else if (size < info->size)
+                shrank++;
+            else
+                same++;
+            live_bytes += size - info->size;
+            info->size = size;
+            info->reallocs++;
+            break;
+        case 'f':
+            if (info == NULL || !info->live)
+                break;
+            hist_record(&sizes[OP_FREE], info->size);
+            log_counts[OP_FREE][log2_bucket(info->size)]++;
+            hist_record(lifetimes, op - info->born);
+            if (info->reallocs > 0) {
+                hist_record(chains, info->reallocs);
+                chained++;
+                if (info->first_size > 0)
+                    growth_sum += (double) info->size / info->first_size;
+            }
+            live_bytes -= info->size;
+            live_blocks--;
+            info->live = false;
+            break;
+        default:
+            app_error("Bogus request type: ", buf);
+        }
+        op++;
+
+        if (live_bytes > peak_bytes) {
+            peak_bytes = live_bytes;
+            peak_bytes_op = op;
+        }
+        if (live_blocks > peak_blocks) {
+            peak_blocks = live_blocks;
+            peak_blocks_op = op;
+        }
+        if (live_bytes > window_bytes)
+            window_bytes = live_bytes;
+        if (live_blocks > window_blocks)
+            window_blocks = live_blocks;
+        if (op % window == 0 || op == (uint64_t) num_ops) {
+            printf("  %12lu %14zu %12ld\n", (unsigned long) op,
+                   window_bytes, window_blocks);
+            window_bytes = live_bytes;
+            window_blocks = live_blocks;
+        }
+    }
+    fclose(f);
+    if (op != (uint64_t) num_ops)
+        fprintf(stderr, "traceinfo: Warning: %s has %lu requests, header says %ld\n",
+                filename, (unsigned long) op, num_ops);
+
+    /* Blocks still live at the end */
+    for (i = 0; i < num_ids; i++) {
+        if (!ids[i].live)
+            continue;
+        never_freed++;
+        if (ids[i].reallocs > 0) {
+            hist_record(chains, ids[i].reallocs);
+            chained++;
+            if (ids[i].first_size > 0)
+                growth_sum += (double) ids[i].size / ids[i].first_size;
+        }
+    }
+
+    printf("  Peak live bytes %zu after request %lu (header max_alloc %ld)\n",
+           peak_bytes, (unsigned long) peak_bytes_op, max_alloc);
+    printf("  Peak live blocks %ld after request %lu\n",
+           peak_blocks, (unsigned long) peak_blocks_op);
+
+    printf("\nRequest sizes in bytes (free counts the size freed):\n");
+    print_hist_header("request");
+    for (t = 0; t < OP_TYPES; t++)
+        print_hist_line(op_name[t], &sizes[t]);
+
+    printf("\nRequests by power-of-two size:\n");
+    printf("  %12s %12s %12s %12s\n", "bytes", op_name[0], op_name[1], op_name[2]);
+    for (b = 0; b < LOG_BUCKETS; b++) {
+        if (log_counts[OP_ALLOC][b] + log_counts[OP_REALLOC][b] + log_counts[OP_FREE][b] == 0)
+            continue;
+        printf("  %5lu-%-6lu %12lu %12lu %12lu\n",
+               1UL << b, (2UL << b) - 1,
+               (unsigned long) log_counts[OP_ALLOC][b],
+               (unsigned long) log_counts[OP_REALLOC][b],
+               (unsigned long) log_counts[OP_FREE][b]);
+    }
+
+    printf("\nLifetimes in requests, from allocation to free:\n");
+    print_hist_header("lifetime");
+    print_hist_line("freed", lifetimes);
+    printf("  %lu blocks never freed\n", (unsigned long) never_freed);
+
+    printf("\nRealloc chains:\n");
+    print_hist_header("length");
+    print_hist_line("chains", chains);
+    printf("  %lu grew, %lu shrank, %lu kept their size", (unsigned long) grew,
+           (unsigned long) shrank, (unsigned long) same);
+    if (chained > 0)
+        printf("; final/initial size averages %.2f", growth_sum / chained);
+    printf("\n");
+
+    print_classes(requests);
+    printf("\n");
+
+    free(ids);
+    free(sizes);
+    free(lifetimes);
+    free(chains);
+    free(requests);
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-h] [-k <classes>] [-p <pct>] [-t <points>] <file.rep>...\n", prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-k <classes>  Number of size classes to propose (default 10)\n");
+    fprintf(stderr, "\t-p <pct>      Percent of requests the classes cover (default 95)\n");
+    fprintf(stderr, "\t-t <points>   Number of points in the live-set timeline (default 20)\n");
+    fprintf(stderr, "\t-h            Print this message\n");
+}
+
+int main(int argc, char **argv) {
+    int c;
+
+    while ((c = getopt(argc, argv, "hk:p:t:")) != -1) {
+        switch (c) {
+        case 'k':
+            num_classes = atoi(optarg);
+            break;
+        case 'p':
+            coverage = atof(optarg);
+            break;
+        case 't':
+            timeline_points = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (num_classes < 1 || coverage <= 0 || coverage > 100 || timeline_points < 1)
+        app_error("Need classes >= 1, 0 < pct <= 100 and points >= 1", "");
+    if (optind == argc) {
+        usage(argv[0]);
+        exit(1);
+    }
+    for (; optind < argc; optind++)
+        profile(argv[optind]);
+    return 0;
+}
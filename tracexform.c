@@ -0,0 +1,325 @@
+/*
+ * tracexform.c - Transform .rep traces
+ *
+ * Reads one or more traces and writes one, applying in order:
+ *
+ *   concatenate  the input traces, one after another, with the ids of
+ *                each moved past those of the traces before it
+ *   slice        (-r i:j) keep only requests [i, j) of the result,
+ *                preceded by a prologue that allocates every block
+ *                live just before request i, at its size then
+ *   thin         (-k fraction) keep about that fraction of the ids,
+ *                with all of their requests, chosen by a hash of the
+ *                id and the seed (-S), so every alloc keeps its
+ *                reallocs and free
+ *   scale        (-m factor) multiply every size, rounding up
+ *   clamp        (-c min:max) limit every size to [min, max]
+ *
+ * Request numbers for -r count from 0, as in mdriver -W, which gives
+ * them for the slowest windows of a trace.  Blocks still live at the
+ * end are freed, since the driver replays each trace more than once
+ * and expects it to leave an empty heap.  The surviving ids are
+ * renumbered densely in order of first use, and the header is
+ * recomputed: num_ids, num_ops, and max_alloc as the peak of live
+ * bytes.  The weight is that of the first input unless -w is given.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define MAXLINE 1024
+
+typedef struct {
+    char type;                    /* 'a', 'r' or 'f' */
+    long id;
+    size_t size;
+} req_t;
+
+/* The concatenated input */
+static req_t *reqs;
+static long num_reqs = 0;
+static long max_reqs = 0;
+static long num_ids = 0;
+static int weight = -1;
+
+static void app_error(const char *msg, const char *arg) {
+    fprintf(stderr, "tracexform: %s%s\n", msg, arg);
+    exit(1);
+}
+
+static void add_req(char type, long id, size_t size) {
+    if (num_reqs == max_reqs) {
+        max_reqs = max_reqs ? 2 * max_reqs : 1 << 16;
+        if ((reqs = realloc(reqs, max_reqs * sizeof(req_t))) == NULL)
+            app_error("Out of memory for requests", "");
+    }
+    reqs[num_reqs].type = type;
+    reqs[num_reqs].id = id;
+    reqs[num_reqs].size = size;
+    num_reqs++;
+}
+
+/* Append the requests of a trace, with its ids moved up by num_ids */
+static void read_rep(const char *filename) {
+    FILE *f;
+    char buf[MAXLINE];
+    long w, ids, ops, max_alloc;
+
+    if ((f = fopen(filename, "r")) == NULL)
+        app_error("Could not open ", filename);
+    if (fscanf(f, "%ld %ld %ld %ld", &w, &ids, &ops, &max_alloc) != 4 ||
+        w < 0 || w > 3 || ids < 0 || ops < 0)
+        app_error("Bad header in ", filename);
+    if (weight < 0)
+        weight = (int) w;
+
+    /* Skip the rest of the header line */
+    if (fgets(buf, MAXLINE, f) == NULL)
+        buf[0] = 0;
+    while (fgets(buf, MAXLINE, f) != NULL) {
+        char type;
+        long id;
+        size_t size = 0;
+        int n = sscanf(buf, " %c %ld %zu", &type, &id, &size);
+
+        if (n < 1)
+            continue;
+        if (n < 2 || (type != 'f' && n < 3) ||
+            (type != 'a' && type != 'r' && type != 'f'))
+            app_error("Bad request: ", buf);
+        if (id >= ids || (id < 0 && type != 'f'))
+            app_error("Bad id in request: ", buf);
+        /* free(NULL) keeps its negative id */
+        add_req(type, id < 0 ? id : id + num_ids, size);
+    }
+    fclose(f);
+    num_ids += ids;
+}
+
+/*
+ * slice - Keep requests [first, end), after a prologue allocating the
+ *     blocks live just before request first.  Replaces reqs.
+ */
+static void slice(long first, long end) {
+    size_t *size = calloc(num_ids > 0 ? num_ids : 1, sizeof(size_t));
+    bool *live = calloc(num_ids > 0 ? num_ids : 1, sizeof(bool));
+    req_t *all = reqs;
+    long n = num_reqs, i;
+
+    if (size == NULL || live == NULL)
+        app_error("Out of memory for the live set", "");
+    if (end > n)
+        end = n;
+    if (first < 0 || first > end)
+        app_error("Bad range for -r", "");
+    for (i = 0; i < first; i++) {
+        if (all[i].id < 0)
+            continue;
+        live[all[i].id] = all[i].type != 'f' &&
+            !(all[i].type == 'r' && all[i].size == 0);
+        size[all[i].id] = all[i].size;
+    }
+
+    reqs = NULL;
+    num_reqs = max_reqs = 0;
+    for (i = 0; i < num_ids; i++) {
+        if (live[i])
+            add_req('a', i, size[i]);
+    }
+    for (i = first; i < end; i++)
+        add_req(all[i].type, all[i].id, all[i].size);
+    free(all);
+    free(size);
+    free(live);
+}
+
+/* Keep an id if its hash, scaled to [0, 1), is below keep */
+static bool keep_id(long id, uint64_t seed, double keep) {
+    uint64_t z = (uint64_t) id + seed * 0x9E3779B97F4A7C15ull;
+    /* splitmix64 finalizer */
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0) < keep;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-h] [-r <first>:<end>] [-k <fraction>] [-S <seed>]\n", prog);
+    fprintf(stderr, "       [-m <factor>] [-c <min>:<max>] [-w <weight>] [-o <file>] <file.rep>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-r <i>:<j>      Keep requests [i, j), with a prologue recreating the live set\n");
+    fprintf(stderr, "\t-k <fraction>   Keep about this fraction of the ids (default 1)\n");
+    fprintf(stderr, "\t-S <seed>       Seed for choosing the ids -k keeps\n");
+    fprintf(stderr, "\t-m <factor>     Multiply every size by <factor>\n");
+    fprintf(stderr, "\t-c <min>:<max>  Clamp every size to [min, max]\n");
+    fprintf(stderr, "\t-w <weight>     Weight of the output (default that of the first input)\n");
+    fprintf(stderr, "\t-o <file>       Output file (default stdout)\n");
+    fprintf(stderr, "\t-h              Print this message\n");
+    fprintf(stderr, "Several inputs are concatenated, with their ids renumbered\n");
+}
+
+int main(int argc, char **argv) {
+    char *outname = NULL;
+    long first = 0, end = -1;
+    double keep = 1.0, factor = 1.0;
+    size_t min_size = 0, max_size = SIZE_MAX;
+    uint64_t seed = 0;
+    int out_weight = -1;
+    long *newid;
+    size_t *cur;
+    bool *live;
+    long out_ids = 0, out_ops = 0, i;
+    size_t live_bytes = 0, max_bytes = 0;
+    FILE *body, *out;
+    char buf[1 << 16];
+    size_t n;
+    int c;
+
+    while ((c = getopt(argc, argv, "hr:k:S:m:c:w:o:")) != -1) {
+        switch (c) {
+        case 'r':
+            if (sscanf(optarg, "%ld:%ld", &first, &end) != 2 || first < 0 || end < first)
+                app_error("Range must be <first>:<end> with first <= end: ", optarg);
+            break;
+        case 'k':
+            keep = atof(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'm':
+            factor = atof(optarg);
+            break;
+        case 'c':
+            if (sscanf(optarg, "%zu:%zu", &min_size, &max_size) != 2 || min_size > max_size)
+                app_error("Clamp must be <min>:<max> with min <= max: ", optarg);
+            break;
+        case 'w':
+            out_weight = atoi(optarg);
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (keep <= 0 || keep > 1 || factor <= 0)
+        app_error("Need 0 < fraction <= 1 and factor > 0", "");
+    if (out_weight > 3)
+        app_error("Weight must be in {0, 1, 2, 3}", "");
+    if (optind == argc) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    for (; optind < argc; optind++)
+        read_rep(argv[optind]);
+    if (out_weight >= 0)
+        weight = out_weight;
+    if (end >= 0)
+        slice(first, end);
+
+    /*
+     * Thin, scale and clamp, renumbering the ids that survive and
+     * checking that each request refers to a live block
+     */
+    newid = malloc((num_ids > 0 ? num_ids : 1) * sizeof(long));
+    cur = calloc(num_ids > 0 ? num_ids : 1, sizeof(size_t));
+    live = calloc(num_ids > 0 ? num_ids : 1, sizeof(bool));
+    if (newid == NULL || cur == NULL || live == NULL)
+        app_error("Out of memory for ids", "");
+    for (i = 0; i < num_ids; i++)
+        newid[i] = -1;
+    if ((body = tmpfile()) == NULL)
+        app_error("Could not create temporary file", "");
+
+    for (i = 0; i < num_reqs; i++) {
+        req_t *r = &reqs[i];
+        size_t size = r->size;
+
+        if (r->id < 0) {
+            fprintf(body, "f %ld\n", r->id);
+            out_ops++;
+            continue;
+        }
+        if (keep < 1 && !keep_id(r->id, seed, keep))
+            continue;
+        if (r->type != 'f' && size > 0) {
+            double scaled = ceil(size * factor);
+            size = scaled >= (double) SIZE_MAX ? SIZE_MAX : (size_t) scaled;
+            if (size < min_size)
+                size = min_size;
+            if (size > max_size)
+                size = max_size;
+            if (size == 0)
+                size = 1;
+        }
+
+        if (r->type == 'a') {
+            if (newid[r->id] < 0)
+                newid[r->id] = out_ids++;
+            fprintf(body, "a %ld %zu\n", newid[r->id], size);
+            live_bytes += size - cur[r->id];
+            cur[r->id] = size;
+            live[r->id] = true;
+        } else {
+            if (newid[r->id] < 0) {
+                snprintf(buf, MAXLINE, "%c %ld", r->type, r->id);
+                app_error("Request before any alloc of its id: ", buf);
+            }
+            if (r->type == 'r') {
+                fprintf(body, "r %ld %zu\n", newid[r->id], size);
+                live_bytes = live_bytes - cur[r->id] + size;
+                cur[r->id] = size;
+                live[r->id] = size > 0;
+            } else {
+                fprintf(body, "f %ld\n", newid[r->id]);
+                live_bytes -= cur[r->id];
+                cur[r->id] = 0;
+                live[r->id] = false;
+            }
+        }
+        out_ops++;
+        if (live_bytes > max_bytes)
+            max_bytes = live_bytes;
+    }
+
+    /* Leave an empty heap */
+    for (i = 0; i < num_ids; i++) {
+        if (live[i]) {
+            fprintf(body, "f %ld\n", newid[i]);
+            out_ops++;
+        }
+    }
+
+    if (outname == NULL)
+        out = stdout;
+    else if ((out = fopen(outname, "w")) == NULL)
+        app_error("Could not open ", outname);
+    fprintf(out, "%d\n%ld\n%ld\n%zu\n", weight, out_ids, out_ops, max_bytes);
+    rewind(body);
+    while ((n = fread(buf, 1, sizeof(buf), body)) > 0) {
+        if (fwrite(buf, 1, n, out) != n)
+            app_error("Could not write trace", "");
+    }
+    fclose(body);
+    if (out != stdout && fclose(out) != 0)
+        app_error("Could not write ", outname);
+
+    fprintf(stderr, "tracexform: %ld ops, %ld ids, peak %zu bytes live\n",
+            out_ops, out_ids, max_bytes);
+    free(reqs);
+    free(newid);
+    free(cur);
+    free(live);
+    return 0;
+}